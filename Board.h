@@ -143,6 +143,7 @@ public:
 
     void startNewGame(bool isWhite) {
         m_board.reset();
+        m_moveHistory.clear();
         m_playerIsWhite = isWhite;
         m_currentPlayerIsWhite = true;
         m_nextBoards = Chess::Calculator::getNextBoardsWhiteMultimap(m_board);
@@ -272,8 +273,34 @@ public:
         else return glm::ivec2(7 - m_chosenPiece.x, m_chosenPiece.y);
     }
 
+    //keys of the positions played before the current one, oldest first
+    std::vector<uint64_t> getKeyHistory() const
+    {
+        std::vector<uint64_t> keys;
+        keys.reserve(m_moveHistory.size());
+        for (const auto& board : m_moveHistory)
+            keys.push_back(board.getKey());
+        return keys;
+    }
+
+    //threefold repetition, fifty move rule or insufficient material, detected the same way the ai search does
+    bool isDraw() const
+    {
+        if (m_board.isFiftyMoveDraw() && !m_nextBoards.empty())
+            return true;
+
+        if (m_board.isInsufficientMaterial())
+            return true;
+
+        return Chess::Board::isRepetition(getKeyHistory(), m_board.getKey(),
+            m_board.getHalfmoveClock(), 2);
+    }
+
     bool shouldContinue() const //returns false if game is finished
     {
+        if (isDraw())
+            return false;
+
         if (!m_nextBoards.empty())
             return true;
 
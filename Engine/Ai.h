@@ -1,86 +1,423 @@
 #pragma once
 #include <functional>
 #include <atomic>
+#include <span>
+#include <mutex>
+#include <condition_variable>
+#include <stop_token>
+#include <memory>
+#include <optional>
+#include <chrono>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 #include "Chess.h"
 #include "Constants.h"
+#include "PawnStructure.h"
+#include "PieceActivity.h"
+#include "EvalCache.h"
+#include "Endgames.h"
+#include "Nnue.h"
+#include "SearchStack.h"
+#include "SpscQueue.h"
 #include "Multithreading/ThreadPool.h"
 
-#ifdef _DEBUG
 #include "Profiler.h"
-#endif
 
 namespace Chess
 {
+    // Profiler zones of the search, recorded only in builds with CHESS_PROFILING.
+    // The ones entered on every node are sampled
+    enum class SearchZone
+    {
+        MoveSelection,
+        PositionEvaluation,
+        BoardGeneration,
+        BoardSorting,
+        Count
+    };
+
+    inline const char* getZoneName(SearchZone zone)
+    {
+        switch (zone)
+        {
+        case SearchZone::MoveSelection: return "Ai move selection";
+        case SearchZone::PositionEvaluation: return "Position evaluation";
+        case SearchZone::BoardGeneration: return "Possible boards generation";
+        case SearchZone::BoardSorting: return "Board sorting";
+        default: return "Unknown";
+        }
+    }
+
     class Ai {
+        friend class MicroBenchmarks; // times the private evaluation and ordering steps
+
     public:
-        // Basic piece values for material evaluation:
-        static inline const std::array<int, static_cast<size_t>(PieceTypes::NUM)> pieceValues = {
-            0,      //EMPTY
-            100,    //WHITE_PAWN
-            300,    //WHITE_KNIGHT
-            300,    //WHITE_BISHOP
-            500,    //WHITE_ROOK
-            900,    //WHITE_QUEEN
-            0,      //WHITE_KING //kings are always on the board, no need to count them
-
-            -100,   //BLACK_PAWN
-            -300,   //BLACK_KNIGHT
-            -300,   //BLACK_BISHOP
-            -500,   //BLACK_ROOK
-            -900,   //BLACK_QUEEN
-            0       //BLACK_KING
+        // Move ordering score given to every capture on top of its MVV-LVA value
+        static inline const int CAPTURE_BONUS = 10000;
+        // Move ordering score of the first killer move of the ply, the second one gets half of it
+        static inline const int KILLER_BONUS = 5000;
+
+        // Internal iterative deepening: PV and cut nodes at or above this depth that have
+        // no capture to try first run a search reduced by IID_REDUCTION to find one.
+        // Define CHESS_USE_IIR to reduce the node's depth by one instead (internal iterative reduction)
+        static inline const int IID_MIN_DEPTH = 3;
+        static inline const int IID_REDUCTION = 2;
+
+        // ProbCut: cut nodes at or above this depth try captures that could clear beta + margin
+        // with a null window search reduced by the ProbCut reduction, and cut off when one does
+        static inline const int PROBCUT_MIN_DEPTH = 5;
+        static inline const int PROBCUT_DEFAULT_MARGIN = 200;
+        static inline const int PROBCUT_DEFAULT_REDUCTION = 3;
+
+        // Mate scores: being mated at ply p scores -(MATE_SCORE - p), so shorter mates score higher.
+        // Scores beyond MATE_THRESHOLD are mates, selective pruning leaves them alone
+        static inline const int MATE_SCORE = 20000;
+        static inline const int MAX_SEARCH_PLY = 256;
+        static inline const int MATE_THRESHOLD = MATE_SCORE - MAX_SEARCH_PLY;
+
+        // Nodes searched between two checks of the stop and pause requests
+        static inline const size_t STOP_CHECK_INTERVAL = 256;
+
+        // A running search publishes its progress at least this often, besides after every iteration
+        static inline const std::chrono::milliseconds INFO_INTERVAL{ 100 };
+        // Progress records a search can queue before the reader drains them, newer ones are dropped when full
+        static inline const size_t INFO_QUEUE_SIZE = 64;
+        static inline const size_t MAX_INFO_PV_LENGTH = 32;
+
+        // Positions tapered together by evaluateBatch, one per AVX2 lane
+        static inline const size_t EVALUATION_BATCH_SIZE = 8;
+
+        enum class Evaluator : uint8_t
+        {
+            CLASSICAL,  // handcrafted terms
+            NNUE        // neural network, needs loadNetwork first
         };
 
-        static inline const std::array<std::array<int, 64>,
-            static_cast<size_t>(PieceTypes::NUM)> pieceSquareTables = {
-                emptyTable,         //EMPTY
-                whitePawnTable,     //WHITE_PAWN
-                whiteKnightTable,   //WHITE_KNIGHT
-                whiteBishopTable,   //WHITE_BISHOP
-                whiteRookTable,     //WHITE_ROOK
-                whiteQueenTable,    //WHITE_QUEEN
-                whiteKingTable,     //WHITE_KING
-                blackPawnTable,     //BLACK_PAWN
-                blackKnightTable,   //BLACK_KNIGHT
-                blackBishopTable,   //BLACK_BISHOP
-                blackRookTable,     //BLACK_ROOK
-                blackQueenTable,    //BLACK_QUEEN
-                blackKingTable      //BLACK_KING
+        // Expected node type, used to decide where the selective search techniques apply
+        enum class NodeType : uint8_t
+        {
+            PV,
+            CUT,
+            ALL
+        };
+
+        struct SearchStatistics
+        {
+            size_t nodes = 0;
+            int selDepth = 0;           // deepest ply reached
+            size_t iidCandidates = 0;   // PV/cut nodes without a good first move
+            size_t iidSearches = 0;     // reduced searches actually run
+            size_t iidNodes = 0;        // nodes spent inside those reduced searches
+            size_t iidFirstMoveCutoffs = 0; // cut nodes where the move found by IID produced the cutoff
+            size_t iirReductions = 0;   // nodes whose depth was reduced instead (CHESS_USE_IIR)
+            size_t probCutNodes = 0;    // cut nodes where ProbCut was attempted
+            size_t probCutSearches = 0; // reduced null window searches of captures
+            size_t probCutCutoffs = 0;  // nodes cut by ProbCut
+            size_t repetitionDraws = 0; // nodes cut as a repetition of the game or the search path
+            size_t fiftyMoveDraws = 0;  // nodes cut by the fifty move rule
+            size_t insufficientMaterialDraws = 0; // nodes where neither side can mate anymore
+            size_t mateDistanceCutoffs = 0; // nodes where no mate could beat one already found
+            size_t pawnHashProbes = 0;
+            size_t pawnHashHits = 0;
+            size_t fullEvaluations = 0; // evaluations that built the attack maps
+            size_t lazyEvaluations = 0; // evaluations cut short by the lazy margin
+            size_t evalCacheProbes = 0;
+            size_t evalCacheHits = 0;
+            size_t endgameEvaluations = 0; // positions scored by a specialised endgame evaluator
+        };
+
+        // What one search started by startSearch looks for
+        struct SearchLimits
+        {
+            bool isWhite = true; // side to move at the root
+            size_t depth = 4;
+            bool keepKillers = false; // start from the worker's killers, for a position close to its last search
+        };
+
+        // One line of a MultiPV analysis
+        struct AnalysisLine
+        {
+            Board board; // after the line's first move
+            int score = 0; // from the searching side's perspective
+            std::vector<Board::Move> pv;
+        };
+
+        // Progress of a running search, published after every completed iteration and every INFO_INTERVAL.
+        // Fixed size so the search can publish it without allocating
+        struct SearchInfo
+        {
+            int depth = 0;          // last completed iteration
+            int selDepth = 0;
+            int score = 0;          // of the last completed iteration, from the searching side's perspective
+            std::array<Board::Move, MAX_INFO_PV_LENGTH> pv;
+            size_t pvLength = 0;
+            size_t nodes = 0;
+            size_t nodesPerSecond = 0;
+            int hashfull = 0;       // eval cache occupancy per mille
+            double seconds = 0.0;
+            bool iterationCompleted = false; // published at the end of an iteration, not by the timer
+
+            std::span<const Board::Move> getPv() const { return { pv.data(), pvLength }; };
+        };
+
+    private:
+        // State of one search shared by its task and its handles. The search itself runs on a worker Ai
+        // that is only attached while the search runs
+        struct SearchContext
+        {
+            SearchLimits limits;
+            std::stop_source stopSource;
+
+            std::mutex mutex;
+            std::condition_variable finishedCondition;
+            bool finished = false;
+            bool callbackRunning = false; // a finished search's callback hasn't returned yet
+            bool paused = false;
+            Ai* worker = nullptr;
+            SpscQueue<SearchInfo, INFO_QUEUE_SIZE> infoQueue; // the worker produces, a handle consumes
+            std::function<void(Board)> callback; // can be replaced until the search finishes
+
+            // valid once finished
+            std::optional<Board> result; // empty when the search was stopped
+            SearchStatistics statistics;
+            std::vector<Board::Move> principalVariation;
+
+            SearchContext(const SearchLimits& searchLimits, std::function<void(Board)> searchCallback)
+                : limits(searchLimits), callback(std::move(searchCallback)) {};
+
+            void attach(Ai* searchWorker)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                worker = searchWorker;
+                worker->setPaused(paused);
+                worker->m_infoQueue = &infoQueue;
+            }
+
+            // copies the results out of the worker, which can be released afterwards
+            void detach(Ai* searchWorker, std::optional<Board> bestBoard)
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                worker = nullptr;
+                searchWorker->m_infoQueue = nullptr;
+                result = std::move(bestBoard);
+                statistics = searchWorker->getSearchStatistics();
+                principalVariation = searchWorker->getPrincipalVariation();
+            }
+
+            // the worker is idle again by now. Returns the callback to call with the result, none for a stopped
+            // search. The stop is checked under the lock, so a stop requested after it waits for the callback
+            // instead, through callbackRunning, and one requested before it means the callback never runs
+            std::function<void(Board)> finish()
+            {
+                std::function<void(Board)> resultCallback;
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    finished = true;
+                    if (result && !stopSource.stop_requested())
+                        resultCallback = std::move(callback);
+                    callbackRunning = resultCallback != nullptr;
+                }
+                finishedCondition.notify_all();
+                return resultCallback;
+            }
+
+            // wakes the handles waiting for the callback to return
+            void finishCallback()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    callbackRunning = false;
+                }
+                finishedCondition.notify_all();
+            }
+        };
+
+    public:
+        // Controls one search and gives access to its result, copies refer to the same search
+        class SearchHandle
+        {
+        private:
+            std::shared_ptr<SearchContext> m_context;
+
+        public:
+            SearchHandle() = default;
+            SearchHandle(std::shared_ptr<SearchContext> context) : m_context(std::move(context)) {};
+
+            bool isValid() const { return m_context != nullptr; };
+            const SearchLimits& getLimits() const { return m_context->limits; };
+
+            // the search unwinds within a few hundred nodes, use wait to know when it did
+            void stop()
+            {
+                m_context->stopSource.request_stop();
+                setPaused(false); // a paused search has to wake up to notice the stop
+            }
+
+            void setPaused(bool paused)
+            {
+                std::lock_guard<std::mutex> lock(m_context->mutex);
+                m_context->paused = paused;
+                if (m_context->worker)
+                    m_context->worker->setPaused(paused);
+            }
+
+            bool isFinished() const
+            {
+                std::lock_guard<std::mutex> lock(m_context->mutex);
+                return m_context->finished;
+            }
+
+            bool isStopped() const { return m_context->stopSource.stop_requested(); };
+
+            // finished and its callback, if it got one, returned
+            bool isDone() const
+            {
+                std::lock_guard<std::mutex> lock(m_context->mutex);
+                return m_context->finished && !m_context->callbackRunning;
+            }
+
+            // blocks until the search has finished and its callback returned, returns its best move, none if it
+            // was stopped. Must not be called while holding what the callback waits for
+            std::optional<Board> wait() const
+            {
+                std::unique_lock<std::mutex> lock(m_context->mutex);
+                m_context->finishedCondition.wait(lock,
+                    [this]() { return m_context->finished && !m_context->callbackRunning; });
+                return m_context->result;
+            }
+
+            void stopAndWait()
+            {
+                stop();
+                wait();
+            }
+
+            // replaces the callback of a running search. A search that already finished with a result gets it
+            // called from the pool, never from the calling thread, which may hold what the callback waits for.
+            // Like the search's own callback it is skipped once stopped, and waited for when stopped later
+            void setCallback(std::function<void(Board)> callback, MT::ThreadPool& pool)
+            {
+                std::lock_guard<std::mutex> lock(m_context->mutex);
+                if (!m_context->finished) {
+                    m_context->callback = std::move(callback);
+                    return;
+                }
+                if (!m_context->result || !callback || m_context->stopSource.stop_requested())
+                    return;
+
+                m_context->callbackRunning = true;
+                pool.pushTask([context = m_context, callback = std::move(callback)]() {
+                    {
+                        std::lock_guard<std::mutex> lock(context->mutex);
+                        if (context->stopSource.stop_requested()) {
+                            context->callbackRunning = false;
+                            context->finishedCondition.notify_all();
+                            return;
+                        }
+                    }
+                    callback(*context->result);
+                    context->finishCallback();
+                    });
+            }
+
+            // the oldest progress record not read yet, only one thread may poll a search
+            bool pollInfo(SearchInfo& info)
+            {
+                return m_context->infoQueue.tryPop(info);
+            }
+
+            // only valid once the search has finished
+            const SearchStatistics& getStatistics() const { return m_context->statistics; };
+            const std::vector<Board::Move>& getPrincipalVariation() const { return m_context->principalVariation; };
         };
 
     private:
         size_t m_searchDepth;
         bool m_isWhite; // Which side the AI plays
-        std::atomic<bool> m_shouldAbort = false;
+        std::stop_token m_stopToken; // of the running search
+        bool m_stopped = false; // the running search was stopped, every node returns right away
         std::atomic<bool> m_isPaused{ false };
-        std::atomic<size_t> m_pendingTasks;
+        std::mutex m_taskMutex; // guards the two lists below, the ponder search and the abort count
+        size_t m_aborts = 0; // abortAndWait calls, a ponder search started across one is stopped right away
+        std::vector<SearchHandle> m_asyncSearches; // started by getBestMoveAsync, stopped by abortAndWait
+        std::vector<std::unique_ptr<Ai>> m_idleWorkers; // finished searches leave their worker for the next one
+
+        // a search of the position after the opponent's expected reply, started by startPondering
+        struct PonderSearch
+        {
+            SearchHandle handle;
+            uint64_t key; // of the position it searches
+        };
+        std::optional<PonderSearch> m_ponderSearch; // guarded by m_taskMutex
+        std::atomic<size_t> m_ponderHits{ 0 };
+        std::atomic<size_t> m_ponderMisses{ 0 };
+        bool m_keepKillers = false; // set by startSearch for the search the worker runs next
+        size_t m_nodeLimit = SIZE_MAX; // the search stops once it visited this many nodes
         std::mutex m_pauseMutex;
         std::condition_variable m_pauseCondition;
+        SearchStatistics m_stats;
+        int m_probCutMargin = PROBCUT_DEFAULT_MARGIN;
+        int m_probCutReduction = PROBCUT_DEFAULT_REDUCTION;
+        std::vector<uint64_t> m_keyHistory; // game history followed by the current search path
+        PawnHashTable m_pawnHashTable; // kept between searches, pawn structures repeat across moves
+        EvalCache m_evalCache; // full evaluations only, lazy ones depend on the window
+        Evaluator m_evaluator = Evaluator::CLASSICAL;
+        Nnue m_nnue;
+        std::vector<Nnue::Accumulator> m_accumulators; // per ply, each derived from the previous ply's
+        SearchStack m_searchStack; // allocated by the first search, reused by every later one
+        SpscQueue<SearchInfo, INFO_QUEUE_SIZE>* m_infoQueue = nullptr; // set while a handle's search runs
+        SearchInfo m_info; // of the running search, the last completed iteration once it finished
+        std::chrono::steady_clock::time_point m_searchStart;
+        std::chrono::steady_clock::time_point m_lastInfoTime;
 
-#ifdef _DEBUG
-        Profiler<std::thread::id> m_profiler;
-#endif
+        // pops the node's key from the history on every exit from the node, including an abort
+        struct KeyHistoryGuard
+        {
+            std::vector<uint64_t>& keyHistory;
+
+            KeyHistoryGuard(std::vector<uint64_t>& history, uint64_t key) : keyHistory(history)
+            {
+                keyHistory.push_back(key);
+            }
+
+            ~KeyHistoryGuard()
+            {
+                keyHistory.pop_back();
+            }
+        };
 
     public:
         
+        // stops the searches started by getBestMoveAsync and returns as soon as their tasks have finished and
+        // the callbacks already running returned, the ones that didn't start by then are never called. Must not be
+        // called while holding what the callbacks wait for
         void abortAndWait()
         {
-            m_shouldAbort = true;
-            if(m_isPaused)
+            std::vector<SearchHandle> searches;
             {
-                m_isPaused = false;
-                m_pauseCondition.notify_all();
+                std::lock_guard<std::mutex> lock(m_taskMutex);
+                searches.swap(m_asyncSearches);
+                m_ponderSearch.reset();
+                m_aborts++;
             }
-            while (m_pendingTasks.load() > 0)
-            {
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            }
-            m_shouldAbort = false;
+            for (auto& search : searches)
+                search.stopAndWait();
         }
 
+        // pauses the searches started by getBestMoveAsync and the one running on this thread
         void setPaused(bool paused) {
-            m_isPaused = paused;
+            {
+                std::lock_guard<std::mutex> lock(m_taskMutex);
+                for (auto& search : m_asyncSearches)
+                    search.setPaused(paused);
+            }
+            {
+                std::lock_guard<std::mutex> lock(m_pauseMutex);
+                m_isPaused = paused;
+            }
             if (!paused) {
                 m_pauseCondition.notify_all(); // Wake up paused calculation
             }
@@ -88,164 +425,629 @@ namespace Chess
 
         void reset(bool playingWhite, size_t searchDepth = 4)
         {
-            m_shouldAbort = false;
             m_isWhite = playingWhite;
             m_searchDepth = searchDepth;
         }
 
-        //makes a copy of the board for a completely isolated async search, not an expensive operation overall
-        void getBestMoveAsync(Board board, MT::ThreadPool& pool, std::function<void(Board)> callback)
+        // the eval cache gets the largest power of two number of entries that fits in the given size,
+        // searches started by startSearch use the same size
+        void setEvalCacheSize(size_t bytes)
+        {
+            size_t entries = std::bit_floor(std::max<size_t>(bytes / EvalCache::ENTRY_SIZE, 1));
+            if (entries != m_evalCache.getSize())
+                m_evalCache = EvalCache(entries);
+        }
+
+        void setProbCutParameters(int margin, int reduction)
         {
-            pool.pushTask([this, board = std::move(board), callback]() {
+            m_probCutMargin = margin;
+            m_probCutReduction = std::max(reduction, 1);
+        }
+
+        // starts a search on the pool and returns right away. Searches are independent of each other, each runs
+        // on its own worker with its own caches, so several of them can run at once for different games.
+        // The callback is called with the best move once the search finishes, unless it was stopped
+        SearchHandle startSearch(Board board, std::vector<uint64_t> keyHistory, const SearchLimits& limits,
+            MT::ThreadPool& pool, std::function<void(Board)> callback = nullptr)
+        {
+            auto context = std::make_shared<SearchContext>(limits, std::move(callback));
+            pool.pushTask([this, context, board = std::move(board), keyHistory = std::move(keyHistory)]() {
+                std::unique_ptr<Ai> worker = acquireWorker();
+                worker->reset(context->limits.isWhite, context->limits.depth);
+                worker->m_keepKillers = context->limits.keepKillers;
+                context->attach(worker.get());
+
                 Board boardNext;
-                try
                 {
-#ifdef _DEBUG
-                    m_profiler.timeOperation(std::this_thread::get_id(),
-                    "Ai move selection", [this, &boardNext, &board]() {
-                        m_pendingTasks++;
-                        boardNext = getBestMove(board);
-                        m_pendingTasks--;
-                        });
-                    m_profiler.printStats(std::this_thread::get_id());
-                    m_profiler.reset(std::this_thread::get_id());
-#else
-                    m_pendingTasks++;
-                    boardNext = getBestMove(board);
-                    m_pendingTasks--;
+                    PROFILE_ZONE(SearchZone::MoveSelection);
+                    boardNext = worker->getBestMove(board, keyHistory, context->stopSource.get_token());
+                }
+#if defined(_DEBUG) && defined(CHESS_PROFILING)
+                Profiler<SearchZone>::instance().printThreadStats();
+                Profiler<SearchZone>::instance().resetThread();
 #endif
+                bool stopped = context->stopSource.stop_requested();
+                context->detach(worker.get(), stopped ? std::nullopt : std::optional<Board>(boardNext));
+                releaseWorker(std::move(worker));
+                auto callback = context->finish();
+
+                // called outside the context's lock, handles waiting for the search wait for it to return too
+                if (callback) {
                     callback(boardNext);
+                    context->finishCallback();
                 }
-                catch (std::exception& e)
-                {
-                    m_pendingTasks--;
-                    if (e.what() == "Abort")
-                        return;
+                });
+            return SearchHandle(context);
+        }
+
+        //makes a copy of the board for a completely isolated async search, not an expensive operation overall
+        //keyHistory holds the keys of the positions played before the board, used for repetition detection.
+        //A ponder search of the same position becomes the search, the callback is called when it finishes
+        void getBestMoveAsync(Board board, std::vector<uint64_t> keyHistory,
+            MT::ThreadPool& pool, std::function<void(Board)> callback)
+        {
+            SearchLimits limits = { m_isWhite, m_searchDepth };
+            std::optional<PonderSearch> ponder;
+            {
+                std::lock_guard<std::mutex> lock(m_taskMutex);
+                ponder.swap(m_ponderSearch);
+            }
+            if (ponder) {
+                const SearchLimits& ponderLimits = ponder->handle.getLimits();
+                if (ponder->key == board.getKey() &&
+                    ponderLimits.isWhite == limits.isWhite && ponderLimits.depth == limits.depth) {
+                    m_ponderHits++;
+                    ponder->handle.setCallback(std::move(callback), pool);
+                    return;
                 }
 
-                });
+                // the worker returns to the idle list before the real search takes one, so that search
+                // gets it back with its caches and killers
+                m_ponderMisses++;
+                ponder->handle.stopAndWait();
+                limits.keepKillers = true;
+            }
+
+            SearchHandle search = startSearch(std::move(board), std::move(keyHistory), limits, pool, std::move(callback));
+            std::lock_guard<std::mutex> lock(m_taskMutex);
+            std::erase_if(m_asyncSearches, [](const SearchHandle& handle) { return handle.isDone(); });
+            m_asyncSearches.push_back(std::move(search));
         }
 
-        Board getBestMove(const Board& board) {
+        // searches the position after the reply the last search by getBestMoveAsync expects to the move
+        // that led to the board, while the opponent thinks about their actual reply. The search runs like
+        // one started by getBestMoveAsync, the next getBestMoveAsync takes it over on a ponder hit and
+        // stops it otherwise. Returns false when there is no expected reply to search, or when the search
+        // that expected it was stopped, which abortAndWait does to searches whose callback may call this
+        bool startPondering(const Board& board, std::vector<uint64_t> keyHistory, MT::ThreadPool& pool)
+        {
+            std::optional<Board::Move> expectedReply;
+            size_t aborts;
+            {
+                std::lock_guard<std::mutex> lock(m_taskMutex);
+                aborts = m_aborts;
+                for (auto it = m_asyncSearches.rbegin(); it != m_asyncSearches.rend() && !expectedReply; it++) {
+                    if (!it->isFinished() || it->isStopped())
+                        continue;
+                    const auto& pv = it->getPrincipalVariation();
+                    if (pv.size() >= 2 && pv[0] == board.getLastMove())
+                        expectedReply = pv[1];
+                }
+            }
+            if (!expectedReply)
+                return false;
 
-#ifdef _DEBUG
-            std::vector<Chess::Board> possibleBoards;
-            m_profiler.timeOperation(std::this_thread::get_id(),
-                "Possible boards generation", [this, &board, &possibleBoards]() {
-                    possibleBoards = m_isWhite ?
-                        Calculator::getNextBoardsWhite(board) :
-                        Calculator::getNextBoardsBlack(board);
-                });
+            std::vector<Board> replies;
+            if (m_isWhite)
+                Calculator::getNextBoardsBlack(board, replies);
+            else Calculator::getNextBoardsWhite(board, replies);
+            auto reply = std::find_if(replies.begin(), replies.end(),
+                [&expectedReply](const Board& next) { return next.getLastMove() == *expectedReply; });
+            if (reply == replies.end())
+                return false;
 
-            m_profiler.timeOperation(std::this_thread::get_id(),
-                "Board sorting", [this, &board, &possibleBoards]() {
-                    sortBoards(possibleBoards, board, m_isWhite);
-                });
-#else
-            auto possibleBoards = m_isWhite ?
-                Calculator::getNextBoardsWhite(board) :
-                Calculator::getNextBoardsBlack(board);
+            keyHistory.push_back(board.getKey());
+            PonderSearch ponder = { startSearch(*reply, std::move(keyHistory),
+                { m_isWhite, m_searchDepth }, pool), reply->getKey() };
+
+            std::lock_guard<std::mutex> lock(m_taskMutex);
+            if (m_aborts != aborts) {
+                // abortAndWait ran meanwhile and no longer tracks this search
+                ponder.handle.stop();
+                return false;
+            }
+            if (m_ponderSearch)
+                m_ponderSearch->handle.stop();
+            m_ponderSearch = ponder;
+            std::erase_if(m_asyncSearches, [](const SearchHandle& handle) { return handle.isDone(); });
+            m_asyncSearches.push_back(ponder.handle);
+            return true;
+        }
+
+        size_t getPonderHits() const { return m_ponderHits; };
+        size_t getPonderMisses() const { return m_ponderMisses; };
+
+        // iterative deepening up to the search depth, every iteration starts with the previous one's best move.
+        // A search stopped through the stop token returns the best move among the root moves it finished
+        Board getBestMove(const Board& board, const std::vector<uint64_t>& keyHistory = {},
+            std::stop_token stopToken = {}) {
+            std::vector<Chess::Board>& possibleBoards = prepareSearch(board, keyHistory, std::move(stopToken));
+            KeyHistoryGuard rootKey(m_keyHistory, board.getKey());
 
-            sortBoards(possibleBoards, board, m_isWhite);
-#endif
             Board bestBoard;
-            int bestScore = INT_MIN;
+            for (int depth = 1; depth <= static_cast<int>(m_searchDepth) && !possibleBoards.empty(); depth++) {
+                int bestScore;
+                size_t bestIndex = searchRootMoves(depth, 0, bestScore);
+                if (bestScore != -INT_MAX)
+                    bestBoard = possibleBoards[bestIndex];
+                if (m_stopped)
+                    break;
 
-            for (const auto& board : possibleBoards) {
-                int score;
-                score = -minimax(board, m_searchDepth - 1,
-                    !m_isWhite, -INT_MAX, -bestScore);
+                // the best move is searched first by the next iteration, the others keep their order
+                std::rotate(possibleBoards.begin(), possibleBoards.begin() + bestIndex,
+                    possibleBoards.begin() + bestIndex + 1);
+                completeIteration(depth, bestScore, m_searchStack.getPv());
+            }
+            finishSearch();
+            return bestBoard;
+        }
 
-                if (score > bestScore) {
-                    bestScore = score;
-                    bestBoard = board;
+        // Reproducible search for benchmarking: starts from empty caches and killers, and stops after exactly
+        // nodeLimit nodes (0 for no limit) or at the search depth, whichever comes first. The same position,
+        // key history, depth, limit, evaluator and evaluation parameters always visit the same nodes in the
+        // same order, so the node count of getSearchStatistics is a signature of the search's behaviour:
+        // two builds with equal signatures searched the same tree, and only their speed can differ
+        Board getBestMoveDeterministic(const Board& board, size_t nodeLimit = 0,
+            const std::vector<uint64_t>& keyHistory = {})
+        {
+            // cache hits change scores, a cached full evaluation replaces what would have been a lazy one
+            m_pawnHashTable.clear();
+            m_evalCache.clear();
+            m_keepKillers = false;
+            m_nodeLimit = nodeLimit ? nodeLimit : SIZE_MAX;
+            Board bestBoard = getBestMove(board, keyHistory);
+            m_nodeLimit = SIZE_MAX;
+            return bestBoard;
+        }
+
+        // MultiPV analysis: the lineCount best moves of the position, best first. Every line runs its own full
+        // window search over the root moves no earlier line reported, its best move then joins the reported ones
+        // at the front, so the next depth searches the lines in the order of the previous one. Killers, the pawn
+        // hash and the eval cache carry over from line to line. A stopped search returns the lines of the last
+        // completed depth, the first move alone if not even depth one was completed
+        std::vector<AnalysisLine> analyze(const Board& board, size_t lineCount,
+            const std::vector<uint64_t>& keyHistory = {}, std::stop_token stopToken = {})
+        {
+            std::vector<Chess::Board>& possibleBoards = prepareSearch(board, keyHistory, std::move(stopToken));
+            KeyHistoryGuard rootKey(m_keyHistory, board.getKey());
+
+            lineCount = std::min(lineCount, possibleBoards.size());
+            std::vector<AnalysisLine> lines(lineCount);
+            std::vector<AnalysisLine> completedLines;
+            for (int depth = 1; depth <= static_cast<int>(m_searchDepth) && lineCount > 0; depth++) {
+                for (size_t line = 0; line < lineCount; line++) {
+                    int bestScore;
+                    size_t bestIndex = searchRootMoves(depth, line, bestScore);
+                    if (m_stopped)
+                        break;
+
+                    std::rotate(possibleBoards.begin() + line, possibleBoards.begin() + bestIndex,
+                        possibleBoards.begin() + bestIndex + 1);
+                    auto pv = m_searchStack.getPv();
+                    lines[line].board = possibleBoards[line];
+                    lines[line].score = bestScore;
+                    lines[line].pv.assign(pv.begin(), pv.end());
                 }
+                if (m_stopped)
+                    break;
+
+                completedLines = lines;
+                completeIteration(depth, lines[0].score, lines[0].pv);
             }
-            return bestBoard;
+            if (completedLines.empty() && lineCount > 0)
+                completedLines.push_back({ possibleBoards[0], 0, { possibleBoards[0].getLastMove() } });
+            finishSearch();
+            return completedLines;
         }
 
-        size_t getPendingTasks() const
+        // progress of the last search, the final record of its last completed iteration once it finished
+        const SearchInfo& getSearchInfo() const
         {
-            return m_pendingTasks.load();
+            return m_info;
         }
 
-    private:
-        int minimax(const Chess::Board& board, int depth, bool isWhite,
-            int alpha, int beta) {
-            runtimeStateChecks();
+        // the moves the last search expects to be played from its root, the best move first
+        std::vector<Board::Move> getPrincipalVariation() const
+        {
+            if (!m_searchStack.isAllocated())
+                return {};
+            auto pv = m_searchStack.getPv();
+            return std::vector<Board::Move>(pv.begin(), pv.end());
+        }
 
-#ifdef _DEBUG
-            if (depth == 0)
+        // the oldest progress record not read yet of any search started by getBestMoveAsync,
+        // to be drained by one thread, the UI's once per frame
+        bool pollSearchInfo(SearchInfo& info)
+        {
+            std::lock_guard<std::mutex> lock(m_taskMutex);
+            for (auto& search : m_asyncSearches)
+                if (search.pollInfo(info))
+                    return true;
+            return false;
+        }
+
+        size_t getPendingTasks()
+        {
+            std::lock_guard<std::mutex> lock(m_taskMutex);
+            return std::count_if(m_asyncSearches.begin(), m_asyncSearches.end(),
+                [](const SearchHandle& handle) { return !handle.isFinished(); });
+        }
+
+        bool loadNetwork(const std::string& path)
+        {
+            if (!m_nnue.load(path))
+                return false;
+
+            m_accumulators.resize(MAX_SEARCH_PLY + 1);
+            m_evalCache.clear();
+            return true;
+        }
+
+        // the network evaluator can only be selected once a network is loaded
+        bool setEvaluator(Evaluator evaluator)
+        {
+            if (evaluator == Evaluator::NNUE && !m_nnue.isLoaded())
+                return false;
+
+            if (evaluator != m_evaluator)
+                m_evalCache.clear(); // cached scores came from the other evaluator
+            m_evaluator = evaluator;
+            return true;
+        }
+
+        Evaluator getEvaluator() const { return m_evaluator; };
+
+        // evaluations per second of the selected evaluator, bypassing the eval cache.
+        // The network's accumulator is refreshed for every position, which the search only does at the root.
+        // batched runs the classical evaluation through evaluateBatch
+        double benchmarkEvaluation(const std::vector<Board>& positions, bool isWhite,
+            size_t iterations = 10, bool batched = false)
+        {
+            std::vector<int> scores(positions.size());
+            auto start = std::chrono::steady_clock::now();
+            int64_t checksum = 0; // keeps the evaluations from being optimised away
+            for (size_t iteration = 0; iteration < iterations; iteration++)
             {
-                auto scopedTiming = m_profiler.timeOperationScoped(
-                    std::this_thread::get_id(), "Position evaluation");
-                return evaluatePosition(board, isWhite);
+                if (batched && m_evaluator == Evaluator::CLASSICAL) {
+                    evaluateBatch(positions, scores);
+                    checksum += scores.back();
+                    continue;
+                }
+
+                for (const auto& position : positions)
+                {
+                    if (m_evaluator == Evaluator::NNUE) {
+                        m_nnue.refresh(m_accumulators[0], position);
+                        checksum += m_nnue.evaluate(m_accumulators[0], isWhite);
+                    }
+                    else checksum += evaluateClassical(position, isWhite, -INT_MAX, INT_MAX);
+                }
             }
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            volatile int64_t sink = checksum;
+            (void)sink;
+            return seconds > 0 ? positions.size() * iterations / seconds : 0.0;
+        }
 
-            std::vector<Chess::Board> possibleBoards;
-            m_profiler.timeOperation(std::this_thread::get_id(),
-                "Possible boards generation", [this, &isWhite, &board, &possibleBoards]() {
-                    possibleBoards = isWhite ?
-                        Calculator::getNextBoardsWhite(board) :
-                        Calculator::getNextBoardsBlack(board);
-                });
-#else
-            if (depth == 0)
-                return evaluatePosition(board, isWhite);
+        // full window classical evaluations of the boards, from white's perspective. The packed scores of
+        // a batch are gathered into arrays and tapered together, useful where many positions are scored at once
+        void evaluateBatch(std::span<const Board> boards, std::span<int> scores)
+        {
+            alignas(32) std::array<int32_t, EVALUATION_BATCH_SIZE> packedScores;
+            alignas(32) std::array<int32_t, EVALUATION_BATCH_SIZE> phases;
+            alignas(32) std::array<int32_t, EVALUATION_BATCH_SIZE> scales;
+            alignas(32) std::array<int32_t, EVALUATION_BATCH_SIZE> results;
+            std::array<bool, EVALUATION_BATCH_SIZE> isEndgame;
 
-            auto possibleBoards = isWhite ?
-                Calculator::getNextBoardsWhite(board) :
-                Calculator::getNextBoardsBlack(board);
-#endif
+            for (size_t start = 0; start < boards.size(); start += EVALUATION_BATCH_SIZE)
+            {
+                size_t count = std::min(EVALUATION_BATCH_SIZE, boards.size() - start);
+                packedScores.fill(0);
+                phases.fill(0);
+                scales.fill(Endgames::SCALE_NORMAL);
 
-            if (possibleBoards.empty()) {
-                // Checkmate check
-                if (m_isWhite)
+                for (size_t i = 0; i < count; i++)
                 {
-                    if (board.isBlackChecked())
-                        return 20000;
-                    else if (board.isWhiteChecked())
-                        return -20000;
+                    const Board& board = boards[start + i];
+                    isEndgame[i] = probeEndgame(board, scales[i], results[i]);
+                    if (isEndgame[i])
+                        continue;
+
+                    AttackMaps attackMaps;
+                    attackMaps.build(board);
+                    packedScores[i] = board.getPieceSquareScore() + m_pawnHashTable.probe(board) +
+                        PieceActivity::evaluate(board, attackMaps);
+                    phases[i] = board.getPhase();
                 }
-                else
-                {
-                    if (board.isBlackChecked())
-                        return -20000;
-                    else if (board.isWhiteChecked())
-                        return 20000;
+
+                std::array<int32_t, EVALUATION_BATCH_SIZE> endgameScores = results;
+                taperBatch(packedScores.data(), phases.data(), scales.data(), results.data());
+                for (size_t i = 0; i < count; i++)
+                    scores[start + i] = isEndgame[i] ? endgameScores[i] : results[i];
+            }
+        }
+
+        // statistics of the last finished search, only valid when no search is running
+        const SearchStatistics& getSearchStatistics() const
+        {
+            return m_stats;
+        }
+
+        void printSearchStatistics() const
+        {
+            std::cout << "\nSearch statistics:\n";
+            std::cout << "==================\n";
+            std::cout << "Nodes: " << m_stats.nodes << "\n";
+            std::cout << "Selective depth: " << m_stats.selDepth << "\n";
+            std::cout << "IID candidates: " << m_stats.iidCandidates << "\n";
+            std::cout << "IID searches: " << m_stats.iidSearches << "\n";
+            std::cout << "IID nodes: " << m_stats.iidNodes << "\n";
+            std::cout << "IID first move cutoffs: " << m_stats.iidFirstMoveCutoffs << "\n";
+            std::cout << "IIR reductions: " << m_stats.iirReductions << "\n";
+            std::cout << "ProbCut nodes: " << m_stats.probCutNodes << "\n";
+            std::cout << "ProbCut searches: " << m_stats.probCutSearches << "\n";
+            std::cout << "ProbCut cutoffs: " << m_stats.probCutCutoffs << "\n";
+            std::cout << "Repetition draws: " << m_stats.repetitionDraws << "\n";
+            std::cout << "Fifty move draws: " << m_stats.fiftyMoveDraws << "\n";
+            std::cout << "Insufficient material draws: " << m_stats.insufficientMaterialDraws << "\n";
+            std::cout << "Mate distance cutoffs: " << m_stats.mateDistanceCutoffs << "\n";
+            std::cout << "Pawn hash hit rate: " << (m_stats.pawnHashProbes ?
+                100.0 * m_stats.pawnHashHits / m_stats.pawnHashProbes : 0.0) << "%\n";
+            std::cout << "Full evaluations: " << m_stats.fullEvaluations << "\n";
+            std::cout << "Lazy evaluations: " << m_stats.lazyEvaluations << "\n";
+            std::cout << "Eval cache hit rate: " << (m_stats.evalCacheProbes ?
+                100.0 * m_stats.evalCacheHits / m_stats.evalCacheProbes : 0.0) << "%\n";
+            std::cout << "Endgame evaluations: " << m_stats.endgameEvaluations << "\n";
+            std::cout << "==================\n";
+        }
+
+    private:
+        // a worker with this Ai's evaluation settings, an idle one if there is any
+        std::unique_ptr<Ai> acquireWorker()
+        {
+            std::unique_ptr<Ai> worker;
+            {
+                std::lock_guard<std::mutex> lock(m_taskMutex);
+                if (!m_idleWorkers.empty()) {
+                    worker = std::move(m_idleWorkers.back());
+                    m_idleWorkers.pop_back();
                 }
+            }
+            if (!worker)
+                worker = std::make_unique<Ai>();
+
+            if (worker->m_evalCache.getSize() != m_evalCache.getSize())
+                worker->m_evalCache = EvalCache(m_evalCache.getSize());
+            worker->m_probCutMargin = m_probCutMargin;
+            worker->m_probCutReduction = m_probCutReduction;
+            if (m_nnue.isLoaded()) {
+                worker->m_nnue = m_nnue; // shares the network
+                worker->m_accumulators.resize(MAX_SEARCH_PLY + 1);
+            }
+            worker->setEvaluator(m_evaluator);
+            return worker;
+        }
+
+        void releaseWorker(std::unique_ptr<Ai> worker)
+        {
+            std::lock_guard<std::mutex> lock(m_taskMutex);
+            m_idleWorkers.push_back(std::move(worker));
+        }
+
+        static NodeType childNodeType(NodeType nodeType, bool firstChild)
+        {
+            switch (nodeType)
+            {
+            case NodeType::PV:
+                return firstChild ? NodeType::PV : NodeType::CUT;
+            case NodeType::CUT:
+                return NodeType::ALL;
+            default:
+                return NodeType::CUT;
+            }
+        }
+
+        //ply is the distance from the root, used to score mates by their distance
+        int minimax(const Chess::Board& board, int depth, int ply, bool isWhite,
+            int alpha, int beta, NodeType nodeType) {
+            // a stopped search unwinds through here, the returned scores are never used
+            if (m_stats.nodes >= m_nodeLimit)
+                m_stopped = true;
+            if (m_stopped || (++m_stats.nodes % STOP_CHECK_INTERVAL == 0 && runtimeStateChecks()))
+                return 0;
+            m_stats.selDepth = std::max(m_stats.selDepth, ply);
+            m_searchStack.clearPv(ply);
+
+            if (Board::isRepetition(m_keyHistory, board.getKey(), board.getHalfmoveClock())) {
+                m_stats.repetitionDraws++;
+                return 0;
+            }
+
+            if (board.isInsufficientMaterial()) {
+                m_stats.insufficientMaterialDraws++;
+                return 0;
+            }
+
+            // Mate distance pruning: even mating on the next move cannot beat a shorter mate
+            // already found, and being mated here cannot be worse than a quicker loss
+            alpha = std::max(alpha, -MATE_SCORE + ply);
+            beta = std::min(beta, MATE_SCORE - ply - 1);
+            if (alpha >= beta) {
+                m_stats.mateDistanceCutoffs++;
+                return alpha;
+            }
+
+            bool inCheck = isWhite ? board.isWhiteChecked() : board.isBlackChecked();
+            // a mate delivered on the last move still counts, so checked positions are resolved below
+            if (board.isFiftyMoveDraw() && !inCheck) {
+                m_stats.fiftyMoveDraws++;
+                return 0;
+            }
+
+            m_searchStack[ply].board = &board;
+            if (m_evaluator == Evaluator::NNUE)
+                m_nnue.update(m_accumulators[ply - 1], m_accumulators[ply], *m_searchStack[ply - 1].board, board);
+
+            if (depth == 0)
+            {
+                PROFILE_ZONE_SAMPLED(SearchZone::PositionEvaluation);
+                return evaluatePosition(board, ply, isWhite, alpha, beta);
+            }
+
+            std::vector<Chess::Board>& possibleBoards = m_searchStack[ply].moves;
+            {
+                PROFILE_ZONE_SAMPLED(SearchZone::BoardGeneration);
+                generateBoards(board, isWhite, possibleBoards);
+            }
+
+            if (possibleBoards.empty()) {
+                // Checkmate check, scored for the side to move like every other node
+                if (inCheck)
+                    return -MATE_SCORE + ply;
                 return 0; // Stalemate
             }
 
-#ifdef _DEBUG
-            m_profiler.timeOperation(std::this_thread::get_id(),
-                "Board sorting", [this, &board, &isWhite, &possibleBoards]() {
-                    sortBoards(possibleBoards, board, isWhite);
-                });
+            if (board.isFiftyMoveDraw()) {
+                m_stats.fiftyMoveDraws++;
+                return 0;
+            }
+
+            KeyHistoryGuard nodeKey(m_keyHistory, board.getKey());
+
+            {
+                PROFILE_ZONE_SAMPLED(SearchZone::BoardSorting);
+                sortBoards(possibleBoards, board, isWhite, ply);
+            }
+
+            // a static eval means nothing while in check, so it can't pick the captures to try
+            if (nodeType == NodeType::CUT && depth >= PROBCUT_MIN_DEPTH && !inCheck &&
+                std::abs(beta) < MATE_THRESHOLD)
+            {
+                int probCutScore;
+                if (probCut(board, possibleBoards, depth, ply, isWhite, beta, probCutScore))
+                    return probCutScore;
+            }
+
+            bool iidMoveFirst = false;
+            if (depth >= IID_MIN_DEPTH && nodeType != NodeType::ALL &&
+                scoreMoveForOrdering(possibleBoards.front(), board, isWhite, ply) < CAPTURE_BONUS)
+            {
+                m_stats.iidCandidates++;
+#ifdef CHESS_USE_IIR
+                depth--;
+                m_stats.iirReductions++;
 #else
-            sortBoards(possibleBoards, board, isWhite);
+                size_t nodesBefore = m_stats.nodes;
+                size_t bestIndex = searchBestMoveIndex(possibleBoards, depth - IID_REDUCTION, ply,
+                    isWhite, alpha, beta, nodeType);
+                m_stats.iidSearches++;
+                m_stats.iidNodes += m_stats.nodes - nodesBefore;
+
+                // move the found move to the front, keeping the rest in their sorted order
+                std::rotate(possibleBoards.begin(), possibleBoards.begin() + bestIndex,
+                    possibleBoards.begin() + bestIndex + 1);
+                iidMoveFirst = true;
 #endif
+            }
 
             int bestScore = -INT_MAX;
 
-            for (const auto& nextBoard : possibleBoards) {
-                int score = -minimax(nextBoard, depth - 1, !isWhite,
-                    -beta, -alpha);
+            for (size_t i = 0; i < possibleBoards.size(); i++) {
+                int score = -minimax(possibleBoards[i], depth - 1, ply + 1, !isWhite,
+                    -beta, -alpha, childNodeType(nodeType, i == 0));
+                if (m_stopped)
+                    return 0;
+
+                const Board::Move& move = possibleBoards[i].getLastMove();
+                if (score > alpha)
+                    m_searchStack.updatePv(ply, move);
 
                 bestScore = std::max(bestScore, score);
                 alpha = std::max(alpha, score);
 
                 if (alpha >= beta)
+                {
+                    if (i == 0 && iidMoveFirst)
+                        m_stats.iidFirstMoveCutoffs++;
+                    if (!move.hasFlag(Board::Move::Flags::CAPTURE))
+                        m_searchStack.storeKiller(ply, move);
                     return bestScore; // Beta cutoff
+                }
             }
 
             return bestScore;
         }
 
-        // Add move scoring function
-        int scoreMoveForOrdering(const Board& nextBoard, const Chess::Board& board, bool isWhite) {
-            constexpr int CAPTURE_BONUS = 10000;  // Base score for captures
+        // tries the captures of a cut node against a raised beta with a reduced null window search,
+        // returns true and the score to return from the node if one of them clears it
+        bool probCut(const Chess::Board& board, const std::vector<Board>& possibleBoards,
+            int depth, int ply, bool isWhite, int beta, int& score) {
+            int probCutBeta = beta + m_probCutMargin;
+            int staticEval = evaluatePosition(board, ply, isWhite);
+            m_stats.probCutNodes++;
+
+            for (const auto& nextBoard : possibleBoards) {
+                const Board::Move& move = nextBoard.getLastMove();
+                // captures are sorted first, the first quiet move ends them
+                if (!move.hasFlag(Board::Move::Flags::CAPTURE))
+                    break;
+
+                int gain = std::abs(evalParameters().signedPieceValues[static_cast<size_t>(move.getCapturedPiece())]);
+                if (staticEval + gain < probCutBeta)
+                    continue;
+
+                m_stats.probCutSearches++;
+                score = -minimax(nextBoard, std::max(depth - 1 - m_probCutReduction, 0), ply + 1, !isWhite,
+                    -probCutBeta, -probCutBeta + 1, NodeType::ALL);
+                if (m_stopped)
+                    return false;
+
+                if (score >= probCutBeta) {
+                    m_stats.probCutCutoffs++;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // searches the already generated moves of a node and returns the index of the best one,
+        // used by internal iterative deepening to find a move to try first
+        size_t searchBestMoveIndex(const std::vector<Board>& possibleBoards, int depth, int ply,
+            bool isWhite, int alpha, int beta, NodeType nodeType) {
+            size_t bestIndex = 0;
+            int bestScore = -INT_MAX;
+
+            for (size_t i = 0; i < possibleBoards.size(); i++) {
+                int score = -minimax(possibleBoards[i], depth - 1, ply + 1, !isWhite,
+                    -beta, -alpha, childNodeType(nodeType, i == 0));
+                if (m_stopped)
+                    break;
+
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestIndex = i;
+                }
+                alpha = std::max(alpha, score);
+
+                if (alpha >= beta)
+                    break;
+            }
 
+            return bestIndex;
+        }
+
+        // Add move scoring function
+        int scoreMoveForOrdering(const Board& nextBoard, const Chess::Board& board, bool isWhite, int ply) {
             int score = 0;
 
             Board::Move move = nextBoard.getLastMove();
@@ -253,77 +1055,259 @@ namespace Chess
             // If it's a capture, score using MVV-LVA
             if (move.hasFlag(Board::Move::Flags::CAPTURE)) {
                 // Victim value - Attacker value (MVV-LVA)
+                const auto& pieceValues = evalParameters().signedPieceValues;
                 int victimValue = std::abs(pieceValues[static_cast<size_t>(move.getCapturedPiece())]);
                 int attackerValue = std::abs(pieceValues[static_cast<size_t>(move.getMovedPiece())]);
                 score = CAPTURE_BONUS + victimValue - (attackerValue / 100);
             }
+            // quiet moves that refuted a sibling position are likely to refute this one too
+            else if (int killer = m_searchStack.killerIndex(ply, move); killer >= 0) {
+                score = KILLER_BONUS >> killer;
+            }
 
-            //// Prefer moves to better squares
-            score += (pieceSquareTables[static_cast<size_t>(move.getMovedPiece())][move.toSquare] -
-                pieceSquareTables[static_cast<size_t>(move.getMovedPiece())][move.fromSquare]) / 100;
+            //// Prefer moves to better squares, the piece's value cancels out of the midgame difference
+            const auto& pieceScores = evalParameters().pieceScores[static_cast<size_t>(move.getMovedPiece())];
+            score += (midgameValue(pieceScores[move.toSquare]) - midgameValue(pieceScores[move.fromSquare])) / 100;
 
             return score;
         }
 
         // Add move sorting function
-        void sortBoards(std::vector<Board>& boards, const Chess::Board& board, bool isWhite) {
+        void sortBoards(std::vector<Board>& boards, const Chess::Board& board, bool isWhite, int ply) {
             std::sort(boards.begin(), boards.end(),
-                [this, &board, &isWhite](const Board& a, const Board& b) {
-                    return scoreMoveForOrdering(a, board, isWhite) >
-                        scoreMoveForOrdering(b, board, isWhite);
+                [this, &board, &isWhite, ply](const Board& a, const Board& b) {
+                    return scoreMoveForOrdering(a, board, isWhite, ply) >
+                        scoreMoveForOrdering(b, board, isWhite, ply);
                 });
         }
 
-        int evaluatePosition(const Chess::Board& board, bool isWhite) {
-            int score = 0;
-            // Material counting
-            // Piece positioning
-            // Mobility
-            // King safety
-            // Pawn structure
-
-            //white pieces
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::WHITE_BISHOP), PieceTypes::WHITE_BISHOP);
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::WHITE_KNIGHT), PieceTypes::WHITE_KNIGHT);
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::WHITE_PAWN), PieceTypes::WHITE_PAWN);
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::WHITE_ROOK), PieceTypes::WHITE_ROOK);
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::WHITE_QUEEN), PieceTypes::WHITE_QUEEN);
-
-            //black pieces
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::BLACK_BISHOP), PieceTypes::BLACK_BISHOP);
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::BLACK_KNIGHT), PieceTypes::BLACK_KNIGHT);
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::BLACK_PAWN), PieceTypes::BLACK_PAWN);
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::BLACK_ROOK), PieceTypes::BLACK_ROOK);
-            score += getPieceScore(board.getBitBoard().getPieceMask(PieceTypes::BLACK_QUEEN), PieceTypes::BLACK_QUEEN);
-            
+        static inline void generateBoards(const Chess::Board& board, bool isWhite, std::vector<Board>& boards) {
+            if (isWhite)
+                Calculator::getNextBoardsWhite(board, boards);
+            else Calculator::getNextBoardsBlack(board, boards);
+        }
+
+        // alpha and beta are the window of the side to move, a position far outside of it
+        // is only scored by the cheap incremental terms
+        int evaluatePosition(const Chess::Board& board, int ply, bool isWhite,
+            int alpha = -INT_MAX, int beta = INT_MAX) {
+            int cachedScore;
+            if (m_evalCache.probe(board.getKey(), cachedScore))
+                return isWhite ? cachedScore : -cachedScore;
+
+            if (m_evaluator == Evaluator::NNUE)
+                return evaluateNetwork(board, ply, isWhite);
+            return evaluateClassical(board, isWhite, alpha, beta);
+        }
+
+        // the accumulator of the ply must be up to date
+        int evaluateNetwork(const Chess::Board& board, int ply, bool isWhite) {
+            int score = m_nnue.evaluate(m_accumulators[ply], isWhite);
+            m_evalCache.store(board.getKey(), isWhite ? score : -score);
             return score;
         }
 
-        inline int getPieceScore(uint64_t pieceMask, PieceTypes type)
-        {
-            int score = 0;
-            while (pieceMask) {
-                int square = std::countr_zero(pieceMask);
-                score += pieceValues[static_cast<size_t>(type)];
-                score += pieceSquareTables[static_cast<size_t>(type)][square];
-                pieceMask &= pieceMask - 1;
+        int evaluateClassical(const Chess::Board& board, bool isWhite, int alpha, int beta) {
+            int scale, endgameScore;
+            if (probeEndgame(board, scale, endgameScore))
+                return isWhite ? endgameScore : -endgameScore;
+
+            // material and piece positioning are kept incrementally by the board,
+            // midgame and endgame values are blended by the game phase
+            Score pieceSquareScore = board.getPieceSquareScore();
+
+#ifdef _DEBUG
+            if (pieceSquareScore != board.computePieceSquareScore() ||
+                board.getPhase() != board.computePhase() ||
+                board.getMaterialKey() != board.computeMaterialKey())
+                __debugbreak();
+#endif
+            Score score = pieceSquareScore + m_pawnHashTable.probe(board);
+
+            // tables are from white's perspective, negamax needs the side to move's
+            int lazyScore = taperScore(score, board.getPhase()) * scale / Endgames::SCALE_NORMAL;
+            if (!isWhite)
+                lazyScore = -lazyScore;
+            // lazy evaluation: mobility and king safety are skipped when the incremental material,
+            // piece-square and pawn score is already far outside the search window
+            int lazyMargin = evalParameters().lazyEvalMargin;
+            if (lazyScore - lazyMargin >= beta || lazyScore + lazyMargin <= alpha) {
+                m_stats.lazyEvaluations++;
+                return lazyScore;
             }
-            return score;
+
+            m_stats.fullEvaluations++;
+            AttackMaps attackMaps;
+            attackMaps.build(board);
+            score += PieceActivity::evaluate(board, attackMaps);
+
+            int fullScore = taperScore(score, board.getPhase()) * scale / Endgames::SCALE_NORMAL;
+            m_evalCache.store(board.getKey(), fullScore);
+            return isWhite ? fullScore : -fullScore;
         }
 
-        inline void runtimeStateChecks() {
+        // known endgames are scored by their own evaluator (returns true with the white relative score)
+        // or scaled towards a draw
+        bool probeEndgame(const Chess::Board& board, int& scale, int& endgameScore) {
+            scale = Endgames::SCALE_NORMAL;
+            if (board.getPhase() > Endgames::getMaxPhase())
+                return false;
+
+            const Endgames::Entry* endgame = Endgames::probe(board.getMaterialKey());
+            if (!endgame)
+                return false;
+
+            if (endgame->evaluate) {
+                m_stats.endgameEvaluations++;
+                endgameScore = endgame->evaluate(board, endgame->strongIsWhite);
+                return true;
+            }
+            scale = endgame->scale(board, endgame->strongIsWhite);
+            return false;
+        }
+
+        // tapers and scales a batch of packed scores laid out as structure of arrays,
+        // gives the same results as taperScore followed by the endgame scaling
+        static void taperBatch(const int32_t* packedScores, const int32_t* phases,
+            const int32_t* scales, int32_t* results) {
+#if defined(__AVX2__)
+            __m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(packedScores));
+            __m256i phase = _mm256_min_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(phases)),
+                _mm256_set1_epi32(MAX_GAME_PHASE));
+            __m256i scale = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(scales));
+
+            // same unpacking as midgameValue and endgameValue
+            __m256i midgame = _mm256_srai_epi32(_mm256_slli_epi32(packed, 16), 16);
+            __m256i endgame = _mm256_srai_epi32(_mm256_add_epi32(packed, _mm256_set1_epi32(0x8000)), 16);
+
+            __m256i blended = _mm256_add_epi32(_mm256_mullo_epi32(midgame, phase),
+                _mm256_mullo_epi32(endgame, _mm256_sub_epi32(_mm256_set1_epi32(MAX_GAME_PHASE), phase)));
+            // the sums are small enough for floats to hold exactly and truncation matches integer division
+            __m256i tapered = _mm256_cvttps_epi32(_mm256_div_ps(_mm256_cvtepi32_ps(blended),
+                _mm256_set1_ps(static_cast<float>(MAX_GAME_PHASE))));
+            __m256i scaled = _mm256_cvttps_epi32(_mm256_div_ps(
+                _mm256_cvtepi32_ps(_mm256_mullo_epi32(tapered, scale)),
+                _mm256_set1_ps(static_cast<float>(Endgames::SCALE_NORMAL))));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(results), scaled);
+#else
+            for (size_t i = 0; i < EVALUATION_BATCH_SIZE; i++)
+                results[i] = taperScore(packedScores[i], phases[i]) * scales[i] / Endgames::SCALE_NORMAL;
+#endif
+        }
+
+        static inline int taperScore(Score score, int phase)
+        {
+            phase = std::min(phase, MAX_GAME_PHASE); // promotions can push it past the starting material
+            return (midgameValue(score) * phase + endgameValue(score) * (MAX_GAME_PHASE - phase)) / MAX_GAME_PHASE;
+        }
+
+        // waits while the game is paused, returns true once the search has to stop
+        inline bool runtimeStateChecks() {
             if (m_isPaused) {
                 std::unique_lock<std::mutex> lock(m_pauseMutex);
-                while (m_isPaused) {
-                    // Wait for 100ms at a time
-                    m_pauseCondition.wait_for(lock, std::chrono::milliseconds(100), [this]() {
-                        return !m_isPaused;
-                        });
-                }
+                m_pauseCondition.wait(lock, [this]() { return !m_isPaused; });
+            }
+            m_stopped = m_stopToken.stop_requested();
+            if (m_infoQueue && std::chrono::steady_clock::now() - m_lastInfoTime >= INFO_INTERVAL)
+                publishInfo(false);
+            return m_stopped;
+        }
+
+        // resets the per search state and returns the root moves, ordered. The caller pushes the root's key
+        std::vector<Board>& prepareSearch(const Board& board, const std::vector<uint64_t>& keyHistory,
+            std::stop_token stopToken)
+        {
+            m_stopToken = std::move(stopToken);
+            m_stopped = false;
+            if (!m_searchStack.isAllocated())
+                m_searchStack.allocate(MAX_SEARCH_PLY + 1);
+            if (!m_keepKillers)
+                m_searchStack.clearKillers();
+            m_keepKillers = false;
+            m_searchStack.clearPv(0);
+            std::vector<Chess::Board>& possibleBoards = m_searchStack[0].moves;
+
+            {
+                PROFILE_ZONE(SearchZone::BoardGeneration);
+                generateBoards(board, m_isWhite, possibleBoards);
+            }
+            {
+                PROFILE_ZONE(SearchZone::BoardSorting);
+                sortBoards(possibleBoards, board, m_isWhite, 0);
             }
-            if (m_shouldAbort) {
-                throw std::runtime_error("Abort");
+            m_stats = SearchStatistics();
+            m_pawnHashTable.resetStatistics();
+            m_evalCache.resetStatistics();
+            m_keyHistory.clear();
+            m_keyHistory.reserve(keyHistory.size() + m_searchDepth + 1);
+            m_keyHistory.insert(m_keyHistory.end(), keyHistory.begin(), keyHistory.end());
+
+            m_searchStack[0].board = &board;
+            if (m_evaluator == Evaluator::NNUE)
+                m_nnue.refresh(m_accumulators[0], board);
+
+            m_info = SearchInfo();
+            m_searchStart = m_lastInfoTime = std::chrono::steady_clock::now();
+            return possibleBoards;
+        }
+
+        // full window search of the root moves from firstMove on, returns the index of the best one and its
+        // score in bestScore. The root's principal variation is the best move's. A stopped search returns
+        // the best of the moves it finished, bestScore stays -INT_MAX if it finished none
+        size_t searchRootMoves(int depth, size_t firstMove, int& bestScore)
+        {
+            const std::vector<Chess::Board>& possibleBoards = m_searchStack[0].moves;
+            bestScore = -INT_MAX;
+            size_t bestIndex = firstMove;
+
+            for (size_t i = firstMove; i < possibleBoards.size(); i++) {
+                const auto& board = possibleBoards[i];
+                int score;
+                score = -minimax(board, depth - 1, 1,
+                    !m_isWhite, -INT_MAX, -bestScore, childNodeType(NodeType::PV, i == firstMove));
+                if (m_stopped)
+                    break;
+
+                if (score > bestScore) {
+                    bestScore = score;
+                    bestIndex = i;
+                    m_searchStack.updatePv(0, board.getLastMove());
+                }
             }
+            return bestIndex;
+        }
+
+        void finishSearch()
+        {
+            m_stats.pawnHashProbes = m_pawnHashTable.getProbes();
+            m_stats.pawnHashHits = m_pawnHashTable.getHits();
+            m_stats.evalCacheProbes = m_evalCache.getProbes();
+            m_stats.evalCacheHits = m_evalCache.getHits();
+        }
+
+        void completeIteration(int depth, int score, std::span<const Board::Move> pv)
+        {
+            m_info.depth = depth;
+            m_info.score = score;
+            m_info.pvLength = std::min(pv.size(), MAX_INFO_PV_LENGTH);
+            std::copy(pv.begin(), pv.begin() + m_info.pvLength, m_info.pv.begin());
+            publishInfo(true);
+        }
+
+        // refreshes the running counters of the progress record and queues a copy when a handle reads it.
+        // a full queue drops the record rather than making the search wait for the reader
+        void publishInfo(bool iterationCompleted)
+        {
+            auto now = std::chrono::steady_clock::now();
+            m_lastInfoTime = now;
+            m_info.selDepth = m_stats.selDepth;
+            m_info.nodes = m_stats.nodes;
+            m_info.seconds = std::chrono::duration<double>(now - m_searchStart).count();
+            m_info.nodesPerSecond = m_info.seconds > 0 ? static_cast<size_t>(m_info.nodes / m_info.seconds) : 0;
+            m_info.hashfull = m_evalCache.getHashfull();
+            m_info.iterationCompleted = iterationCompleted;
+            if (m_infoQueue)
+                m_infoQueue->tryPush(m_info);
         }
     };
 }
\ No newline at end of file
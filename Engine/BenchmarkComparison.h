@@ -0,0 +1,323 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <optional>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <random>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#include "MicroBenchmarks.h"
+
+namespace Chess
+{
+    // Compares two result files written by MicroBenchmarks::writeJson, from the microbench or the bench command.
+    // Every benchmark in both files gets the relative change of its median ns/op with a bootstrap confidence
+    // interval: both sample sets are resampled with replacement and the change of the resampled medians is
+    // collected, its percentiles bound the interval. A benchmark regressed when even the interval's lower bound
+    // is slower than the threshold, so noise alone can't fail a comparison
+    class BenchmarkComparison
+    {
+    public:
+        static inline const size_t BOOTSTRAP_ITERATIONS = 2000;
+        static inline const double DEFAULT_THRESHOLD = 0.02;  // 2% slower
+        static inline const double DEFAULT_CONFIDENCE = 0.95;
+
+        struct ResultFile
+        {
+            std::vector<MicroBenchmarks::Result> results;
+            std::optional<size_t> signature;
+        };
+
+        struct Delta
+        {
+            std::string name;
+            double baselineMedian = 0.0;
+            double candidateMedian = 0.0;
+            double change = 0.0; // relative, positive is slower
+            double lower = 0.0;  // confidence interval of the change
+            double upper = 0.0;
+            bool regression = false;
+            bool improvement = false;
+        };
+
+    private:
+        double m_threshold;
+        double m_confidence;
+        std::mt19937_64 m_random{ 0x5eed }; // fixed, the same files always give the same intervals
+
+    public:
+        BenchmarkComparison(double threshold = DEFAULT_THRESHOLD, double confidence = DEFAULT_CONFIDENCE)
+            : m_threshold(threshold), m_confidence(confidence) {};
+
+        // the benchmarks present in both, in the baseline's order
+        std::vector<Delta> compare(const ResultFile& baseline, const ResultFile& candidate)
+        {
+            std::vector<Delta> deltas;
+            for (const auto& before : baseline.results)
+            {
+                auto after = std::find_if(candidate.results.begin(), candidate.results.end(),
+                    [&before](const MicroBenchmarks::Result& result) { return result.name == before.name; });
+                if (after == candidate.results.end() || before.samples.empty() || after->samples.empty())
+                    continue;
+                deltas.push_back(compare(before, *after));
+            }
+            return deltas;
+        }
+
+        // prints the comparison, returns whether any benchmark regressed
+        bool report(const ResultFile& baseline, const ResultFile& candidate)
+        {
+            if (baseline.signature && candidate.signature && *baseline.signature != *candidate.signature)
+                std::cout << "Warning: search signatures differ (" << *baseline.signature << " vs "
+                    << *candidate.signature << "), the searched trees changed\n";
+
+            auto deltas = compare(baseline, candidate);
+            size_t regressions = 0;
+            std::cout << std::fixed << std::setprecision(2);
+            for (const auto& delta : deltas)
+            {
+                std::cout << std::left << std::setw(36) << delta.name << std::right
+                    << std::setw(12) << delta.baselineMedian << " -> " << std::setw(12) << delta.candidateMedian
+                    << " ns/op " << std::showpos << std::setw(8) << delta.change * 100.0 << "% ["
+                    << delta.lower * 100.0 << "%, " << delta.upper * 100.0 << "%]" << std::noshowpos
+                    << (delta.regression ? "  REGRESSION" : delta.improvement ? "  improvement" : "") << "\n";
+                regressions += delta.regression;
+            }
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::setprecision(6);
+
+            std::cout << deltas.size() << " benchmarks compared, " << regressions << " regressed beyond "
+                << m_threshold * 100.0 << "% at " << m_confidence * 100.0 << "% confidence\n";
+            return regressions > 0;
+        }
+
+        static std::optional<ResultFile> read(const std::string& path)
+        {
+            std::ifstream file(path);
+            if (!file) {
+                std::cout << "Could not open " << path << std::endl;
+                return std::nullopt;
+            }
+            std::stringstream buffer;
+            buffer << file.rdbuf();
+
+            std::string text = buffer.str();
+            JsonReader reader(text);
+            auto resultFile = reader.readResultFile();
+            if (!resultFile)
+                std::cout << "Invalid result file " << path << " near offset " << reader.getPosition() << std::endl;
+            return resultFile;
+        }
+
+    private:
+        Delta compare(const MicroBenchmarks::Result& baseline, const MicroBenchmarks::Result& candidate)
+        {
+            Delta delta;
+            delta.name = baseline.name;
+            delta.baselineMedian = median(baseline.samples);
+            delta.candidateMedian = median(candidate.samples);
+            delta.change = delta.candidateMedian / delta.baselineMedian - 1.0;
+
+            std::vector<double> changes(BOOTSTRAP_ITERATIONS);
+            std::vector<double> before(baseline.samples.size());
+            std::vector<double> after(candidate.samples.size());
+            for (double& change : changes)
+            {
+                resample(baseline.samples, before);
+                resample(candidate.samples, after);
+                change = median(after) / median(before) - 1.0;
+            }
+            std::sort(changes.begin(), changes.end());
+            double tail = (1.0 - m_confidence) / 2.0;
+            delta.lower = MicroBenchmarks::percentile(changes, tail);
+            delta.upper = MicroBenchmarks::percentile(changes, 1.0 - tail);
+            delta.regression = delta.lower > m_threshold;
+            delta.improvement = delta.upper < -m_threshold;
+            return delta;
+        }
+
+        void resample(const std::vector<double>& samples, std::vector<double>& resampled)
+        {
+            std::uniform_int_distribution<size_t> pick(0, samples.size() - 1);
+            for (double& sample : resampled)
+                sample = samples[pick(m_random)];
+        }
+
+        static double median(std::vector<double> samples)
+        {
+            std::sort(samples.begin(), samples.end());
+            return MicroBenchmarks::percentile(samples, 0.5);
+        }
+
+        // Just enough json for the result files: objects, arrays, strings without escapes and numbers.
+        // Unknown keys are skipped, so the files can gain fields without breaking older comparators
+        class JsonReader
+        {
+        private:
+            const std::string& m_text;
+            size_t m_position = 0;
+
+        public:
+            JsonReader(const std::string& text) : m_text(text) {};
+
+            size_t getPosition() const { return m_position; };
+
+            std::optional<ResultFile> readResultFile()
+            {
+                ResultFile resultFile;
+                bool valid = readObject([this, &resultFile](const std::string& key) {
+                    if (key == "signature") {
+                        double signature;
+                        if (!readNumber(signature))
+                            return false;
+                        resultFile.signature = static_cast<size_t>(signature);
+                        return true;
+                    }
+                    if (key == "benchmarks")
+                        return readArray([this, &resultFile]() { return readResult(resultFile.results); });
+                    return skipValue();
+                    });
+                if (!valid)
+                    return std::nullopt;
+                return resultFile;
+            }
+
+        private:
+            bool readResult(std::vector<MicroBenchmarks::Result>& results)
+            {
+                std::string name;
+                size_t operationsPerRun = 0;
+                std::vector<double> samples;
+                bool valid = readObject([&](const std::string& key) {
+                    if (key == "name")
+                        return readString(name);
+                    if (key == "operationsPerRun") {
+                        double operations;
+                        if (!readNumber(operations))
+                            return false;
+                        operationsPerRun = static_cast<size_t>(operations);
+                        return true;
+                    }
+                    if (key == "samples")
+                        return readArray([&]() {
+                            double sample;
+                            if (!readNumber(sample))
+                                return false;
+                            samples.push_back(sample);
+                            return true;
+                            });
+                    return skipValue();
+                    });
+                if (valid)
+                    results.push_back(MicroBenchmarks::summarize(std::move(name), operationsPerRun, std::move(samples)));
+                return valid;
+            }
+
+            void skipWhitespace()
+            {
+                while (m_position < m_text.size() && std::isspace(static_cast<unsigned char>(m_text[m_position])))
+                    m_position++;
+            }
+
+            bool consume(char c)
+            {
+                skipWhitespace();
+                if (m_position >= m_text.size() || m_text[m_position] != c)
+                    return false;
+                m_position++;
+                return true;
+            }
+
+            char peek()
+            {
+                skipWhitespace();
+                return m_position < m_text.size() ? m_text[m_position] : '\0';
+            }
+
+            // calls readMember for every key, positioned at the key's value
+            template<typename MemberReader>
+            bool readObject(MemberReader&& readMember)
+            {
+                if (!consume('{'))
+                    return false;
+                if (consume('}'))
+                    return true;
+                do {
+                    std::string key;
+                    if (!readString(key) || !consume(':') || !readMember(key))
+                        return false;
+                } while (consume(','));
+                return consume('}');
+            }
+
+            template<typename ElementReader>
+            bool readArray(ElementReader&& readElement)
+            {
+                if (!consume('['))
+                    return false;
+                if (consume(']'))
+                    return true;
+                do {
+                    if (!readElement())
+                        return false;
+                } while (consume(','));
+                return consume(']');
+            }
+
+            bool readString(std::string& value)
+            {
+                if (!consume('"'))
+                    return false;
+                size_t end = m_text.find('"', m_position);
+                if (end == std::string::npos)
+                    return false;
+                value = m_text.substr(m_position, end - m_position);
+                m_position = end + 1;
+                return true;
+            }
+
+            bool readNumber(double& value)
+            {
+                skipWhitespace();
+                const char* begin = m_text.c_str() + m_position;
+                char* end;
+                value = std::strtod(begin, &end);
+                if (end == begin)
+                    return false;
+                m_position += end - begin;
+                return true;
+            }
+
+            bool skipValue()
+            {
+                switch (peek())
+                {
+                case '{':
+                    return readObject([this](const std::string&) { return skipValue(); });
+                case '[':
+                    return readArray([this]() { return skipValue(); });
+                case '"': {
+                    std::string ignored;
+                    return readString(ignored);
+                }
+                default:
+                    for (const char* literal : { "true", "false", "null" })
+                    {
+                        if (m_text.compare(m_position, std::strlen(literal), literal) == 0) {
+                            m_position += std::strlen(literal);
+                            return true;
+                        }
+                    }
+                    double ignored;
+                    return readNumber(ignored);
+                }
+            }
+        };
+    };
+}
@@ -5,6 +5,10 @@
 #include <unordered_map>
 #include <algorithm>
 #include <bit>
+#include <optional>
+#include <string>
+#include <sstream>
+#include <fstream>
 
 #include "Constants.h"
 #include "MagicBishops.h"
@@ -34,6 +38,269 @@ namespace Chess
         NUM
     };
 
+    // Midgame and endgame values packed into one integer, endgame in the upper 16 bits,
+    // so both phases are accumulated with a single add
+    using Score = int32_t;
+
+    constexpr Score makeScore(int midgame, int endgame)
+    {
+        return static_cast<Score>(static_cast<uint32_t>(endgame) << 16) + midgame;
+    }
+
+    constexpr int midgameValue(Score score)
+    {
+        return static_cast<int16_t>(static_cast<uint16_t>(static_cast<uint32_t>(score)));
+    }
+
+    constexpr int endgameValue(Score score)
+    {
+        return static_cast<int16_t>(static_cast<uint16_t>(static_cast<uint32_t>(score + 0x8000) >> 16));
+    }
+
+    // Every weight of the classical evaluation. Values and tables are given from white's perspective per kind
+    // of piece, pawn to king, the tables indexed by piece type the evaluation reads are derived from them
+    struct EvalParameters
+    {
+        static inline const int PIECE_KINDS = 6;
+        static inline const char* KIND_NAMES[PIECE_KINDS] = { "Pawn", "Knight", "Bishop", "Rook", "Queen", "King" };
+
+        std::array<int, PIECE_KINDS> pieceValues;
+        std::array<std::array<int, 64>, PIECE_KINDS> midgameTables;
+        std::array<std::array<int, 64>, PIECE_KINDS> endgameTables;
+
+        // pawn structure, the passed pawn bonus is indexed by the pawn's rank counted from its own side
+        std::array<Score, 8> passedPawnBonus;
+        Score isolatedPawnPenalty;
+        Score doubledPawnPenalty;
+        Score backwardPawnPenalty;
+
+        // mobility per reachable square above the typical count for the piece, king attack units per attacked king zone square
+        std::array<Score, PIECE_KINDS> mobilityWeights;
+        std::array<int, PIECE_KINDS> mobilityBaseline;
+        std::array<int, PIECE_KINDS> kingAttackUnits;
+        int maxKingAttackUnits;
+        Score pawnShieldBonus;
+
+        int lazyEvalMargin;
+
+        // derived by computeDerivedTables, indexed by piece type, negative for black
+        std::array<int, static_cast<size_t>(PieceTypes::NUM)> signedPieceValues;
+        // material plus piece-square value of every piece on every square
+        std::array<std::array<Score, 64>, static_cast<size_t>(PieceTypes::NUM)> pieceScores;
+
+        static constexpr int pieceKind(PieceTypes type)
+        {
+            return (static_cast<int>(type) - 1) % PIECE_KINDS;
+        }
+
+        constexpr void computeDerivedTables()
+        {
+            signedPieceValues[0] = 0;
+            pieceScores[0] = {};
+            for (int kind = 0; kind < PIECE_KINDS; kind++)
+            {
+                std::array<int, 64> blackMidgame = mirrorTableForBlack(midgameTables[kind]);
+                std::array<int, 64> blackEndgame = mirrorTableForBlack(endgameTables[kind]);
+                size_t white = kind + 1, black = kind + 1 + PIECE_KINDS;
+
+                signedPieceValues[white] = pieceValues[kind];
+                signedPieceValues[black] = -pieceValues[kind];
+                for (int square = 0; square < 64; square++)
+                {
+                    pieceScores[white][square] = makeScore(pieceValues[kind] + midgameTables[kind][square],
+                        pieceValues[kind] + endgameTables[kind][square]);
+                    pieceScores[black][square] = makeScore(-pieceValues[kind] + blackMidgame[square],
+                        -pieceValues[kind] + blackEndgame[square]);
+                }
+            }
+        }
+
+        static constexpr EvalParameters makeDefault()
+        {
+            EvalParameters parameters = {};
+            parameters.pieceValues = { 100, 300, 300, 500, 900, 0 }; //kings are always on the board, no need to count them
+            parameters.midgameTables = { whitePawnTable, whiteKnightTable, whiteBishopTable,
+                whiteRookTable, whiteQueenTable, whiteKingTable };
+            parameters.endgameTables = { whitePawnEndgameTable, whiteKnightTable, whiteBishopTable,
+                whiteRookTable, whiteQueenTable, whiteKingEndgameTable };
+
+            parameters.passedPawnBonus = {
+                makeScore(0, 0),
+                makeScore(0, 5),
+                makeScore(5, 10),
+                makeScore(10, 20),
+                makeScore(20, 40),
+                makeScore(35, 70),
+                makeScore(60, 110),
+                makeScore(0, 0)
+            };
+            parameters.isolatedPawnPenalty = makeScore(-10, -15);
+            parameters.doubledPawnPenalty = makeScore(-10, -20);
+            parameters.backwardPawnPenalty = makeScore(-8, -10);
+
+            parameters.mobilityWeights = { makeScore(0, 0), makeScore(4, 4), makeScore(5, 5),
+                makeScore(2, 4), makeScore(1, 2), makeScore(0, 0) };
+            parameters.mobilityBaseline = { 0, 4, 6, 7, 13, 0 };
+            parameters.kingAttackUnits = { 0, 2, 2, 3, 5, 0 };
+            parameters.maxKingAttackUnits = 60;
+            parameters.pawnShieldBonus = makeScore(10, 0);
+
+            parameters.lazyEvalMargin = 300;
+
+            parameters.computeDerivedTables();
+            return parameters;
+        }
+
+        // text file, one parameter per line: its name followed by its values, scores as midgame endgame pairs.
+        // Parameters missing from the file keep their current value, lines starting with # are comments
+        bool load(const std::string& path)
+        {
+            std::ifstream file(path);
+            if (!file) {
+                std::cout << "Could not open parameter file " << path << std::endl;
+                return false;
+            }
+
+            std::unordered_map<std::string, std::vector<int>> values;
+            std::string line;
+            while (std::getline(file, line))
+            {
+                std::istringstream stream(line);
+                std::string name;
+                if (!(stream >> name) || name[0] == '#')
+                    continue;
+                auto& fieldValues = values[name];
+                int value;
+                while (stream >> value)
+                    fieldValues.push_back(value);
+            }
+
+            bool valid = true;
+            forEachField(*this, [&values, &valid](const std::string& name, int* data, size_t count, bool isScore) {
+                auto it = values.find(name);
+                if (it == values.end())
+                    return;
+
+                const std::vector<int>& fieldValues = it->second;
+                if (fieldValues.size() != (isScore ? 2 * count : count)) {
+                    std::cout << "Parameter " << name << " needs " << (isScore ? 2 * count : count) << " values" << std::endl;
+                    valid = false;
+                }
+                else for (size_t i = 0; i < count; i++)
+                    data[i] = isScore ? makeScore(fieldValues[2 * i], fieldValues[2 * i + 1]) : fieldValues[i];
+                values.erase(it);
+                });
+
+            for (const auto& [name, fieldValues] : values) {
+                std::cout << "Unknown parameter " << name << std::endl;
+                valid = false;
+            }
+            if (!valid)
+                return false;
+
+            computeDerivedTables();
+            std::cout << "Evaluation parameters loaded from " << path << std::endl;
+            return true;
+        }
+
+        bool save(const std::string& path) const
+        {
+            std::ofstream file(path);
+            if (!file) {
+                std::cout << "Could not write " << path << std::endl;
+                return false;
+            }
+
+            forEachField(*this, [&file](const std::string& name, const int* data, size_t count, bool isScore) {
+                file << name;
+                for (size_t i = 0; i < count; i++)
+                {
+                    if (isScore)
+                        file << ' ' << midgameValue(data[i]) << ' ' << endgameValue(data[i]);
+                    else file << ' ' << data[i];
+                }
+                file << '\n';
+                });
+            return static_cast<bool>(file);
+        }
+
+    private:
+        // calls visit(name, values, count, isScore) for every stored parameter, the derived tables excluded
+        template<typename Parameters, typename Visitor>
+        static void forEachField(Parameters& parameters, Visitor&& visit)
+        {
+            visit("pieceValues", parameters.pieceValues.data(), PIECE_KINDS, false);
+            for (int kind = 0; kind < PIECE_KINDS; kind++)
+                visit(std::string("midgameTable") + KIND_NAMES[kind], parameters.midgameTables[kind].data(), 64, false);
+            for (int kind = 0; kind < PIECE_KINDS; kind++)
+                visit(std::string("endgameTable") + KIND_NAMES[kind], parameters.endgameTables[kind].data(), 64, false);
+
+            visit("passedPawnBonus", parameters.passedPawnBonus.data(), 8, true);
+            visit("isolatedPawnPenalty", &parameters.isolatedPawnPenalty, 1, true);
+            visit("doubledPawnPenalty", &parameters.doubledPawnPenalty, 1, true);
+            visit("backwardPawnPenalty", &parameters.backwardPawnPenalty, 1, true);
+
+            visit("mobilityWeights", parameters.mobilityWeights.data(), PIECE_KINDS, true);
+            visit("mobilityBaseline", parameters.mobilityBaseline.data(), PIECE_KINDS, false);
+            visit("kingAttackUnits", parameters.kingAttackUnits.data(), PIECE_KINDS, false);
+            visit("maxKingAttackUnits", &parameters.maxKingAttackUnits, 1, false);
+            visit("pawnShieldBonus", &parameters.pawnShieldBonus, 1, true);
+
+            visit("lazyEvalMargin", &parameters.lazyEvalMargin, 1, false);
+        }
+    };
+
+    inline constexpr EvalParameters DEFAULT_EVAL_PARAMETERS = EvalParameters::makeDefault();
+
+#ifdef CHESS_RUNTIME_EVAL_PARAMETERS
+    // replaced by loadEvalParameters at startup, before any board is set up, and only read afterwards
+    inline EvalParameters runtimeEvalParameters = DEFAULT_EVAL_PARAMETERS;
+
+    inline const EvalParameters& evalParameters() { return runtimeEvalParameters; }
+#else
+    // the weights are compile-time constants the evaluation can be optimised with
+    constexpr const EvalParameters& evalParameters() { return DEFAULT_EVAL_PARAMETERS; }
+#endif
+
+    inline bool loadEvalParameters(const std::string& path)
+    {
+#ifdef CHESS_RUNTIME_EVAL_PARAMETERS
+        EvalParameters parameters = DEFAULT_EVAL_PARAMETERS;
+        if (!parameters.load(path))
+            return false;
+        runtimeEvalParameters = parameters;
+        return true;
+#else
+        std::cout << "Evaluation parameters are compiled in, build with CHESS_RUNTIME_EVAL_PARAMETERS to load "
+            << path << std::endl;
+        return false;
+#endif
+    }
+
+    // Game phase: the non-pawn material left on the board, MAX_GAME_PHASE is the starting position
+    static inline const std::array<int, static_cast<size_t>(PieceTypes::NUM)> PHASE_WEIGHTS = {
+        0,          //EMPTY
+        0, 1, 1, 2, 4, 0,   //WHITE_PAWN ... WHITE_KING
+        0, 1, 1, 2, 4, 0    //BLACK_PAWN ... BLACK_KING
+    };
+
+    static inline const int MAX_GAME_PHASE = 24;
+
+    // Material key: the number of pieces of every type, kings included, packed into MATERIAL_KEY_BITS each.
+    // Positions with the same material share the key, which identifies the endgame being played
+    static inline const int MATERIAL_KEY_BITS = 4;
+    static inline const uint64_t MATERIAL_COUNT_MASK = (1ULL << MATERIAL_KEY_BITS) - 1;
+
+    constexpr uint64_t materialKeyUnit(PieceTypes type)
+    {
+        return 1ULL << (MATERIAL_KEY_BITS * (static_cast<int>(type) - 1));
+    }
+
+    constexpr int materialCount(uint64_t materialKey, PieceTypes type)
+    {
+        return static_cast<int>(materialKey >> (MATERIAL_KEY_BITS * (static_cast<int>(type) - 1)) & MATERIAL_COUNT_MASK);
+    }
+
     class Board
     {
     public:
@@ -133,7 +400,7 @@ namespace Chess
                 flags = (flags >> 3) << 3;
             }
 
-            PieceTypes getPawnPromotion()
+            PieceTypes getPawnPromotion() const
             {
                 return static_cast<PieceTypes>(flags >> 4);
             }
@@ -143,24 +410,25 @@ namespace Chess
                 flags |= static_cast<uint8_t>(promotion) << 4;
             }
 
-            PieceTypes getCapturedPiece()
+            //moved and captured pieces live in pieceTypes, flags only carry the promotion
+            PieceTypes getCapturedPiece() const
             {
-                return static_cast<PieceTypes>(flags >> 4);
+                return static_cast<PieceTypes>(pieceTypes >> 4);
             }
 
-            PieceTypes getMovedPiece()
+            PieceTypes getMovedPiece() const
             {
-                return static_cast<PieceTypes>(flags & 0b00001111);
+                return static_cast<PieceTypes>(pieceTypes & 0b00001111);
             }
 
             void setCapturedPiece(PieceTypes type)
             {
-                flags |= static_cast<uint8_t>(type) << 4;
+                pieceTypes |= static_cast<uint8_t>(type) << 4;
             }
 
             void setMovedPiece(PieceTypes type)
             {
-                flags |= static_cast<uint8_t>(type);
+                pieceTypes |= static_cast<uint8_t>(type);
             }
 
             Move() : fromSquare(0), toSquare(0), pieceTypes(0), flags(static_cast<uint8_t>(0)) {}
@@ -174,6 +442,20 @@ namespace Chess
             Move& operator=(const Move&) = default;
             Move(Move&&) = default;
             Move& operator=(Move&&) = default;
+
+            bool operator==(const Move&) const = default;
+
+            // coordinate notation as in "e2e4", promotions add the piece as in "e7e8q"
+            std::string toString() const
+            {
+                std::string text = {
+                    static_cast<char>('a' + fromSquare % 8), static_cast<char>('1' + fromSquare / 8),
+                    static_cast<char>('a' + toSquare % 8), static_cast<char>('1' + toSquare / 8) };
+                PieceTypes promotion = getPawnPromotion();
+                if (promotion != PieceTypes::EMPTY)
+                    text += "-pnbrqkpnbrqk"[static_cast<int>(promotion)];
+                return text;
+            }
         };
 
         enum class Flags : uint8_t
@@ -191,6 +473,78 @@ namespace Chess
         uint64_t m_enPassantMask = 0; //square on which an en passant capture is possible
         Flag<Flags> m_flags;
         Move m_lastMove;
+        uint64_t m_key = 0; //zobrist key, includes the side to move
+        uint64_t m_pawnKey = 0; //zobrist key of the pawns only, used by the pawn hash table
+        uint16_t m_halfmoveClock = 0; //plies since the last capture or pawn move
+        Score m_pieceSquareScore = 0; //packed material and piece-square sum from white's perspective
+        uint8_t m_phase = 0; //sum of PHASE_WEIGHTS of the pieces on the board
+        uint64_t m_materialKey = 0; //piece counts per type, see materialKeyUnit
+
+        static constexpr uint8_t CASTLING_RIGHTS_SHIFT = 2;
+        static constexpr uint8_t CASTLING_RIGHTS_MASK = 0b1111;
+
+        static inline bool isPawn(int type)
+        {
+            return type == static_cast<int>(PieceTypes::WHITE_PAWN) ||
+                type == static_cast<int>(PieceTypes::BLACK_PAWN);
+        }
+
+        static PieceTypes pieceFromFen(char c)
+        {
+            switch (c)
+            {
+            case 'P': return PieceTypes::WHITE_PAWN;
+            case 'N': return PieceTypes::WHITE_KNIGHT;
+            case 'B': return PieceTypes::WHITE_BISHOP;
+            case 'R': return PieceTypes::WHITE_ROOK;
+            case 'Q': return PieceTypes::WHITE_QUEEN;
+            case 'K': return PieceTypes::WHITE_KING;
+            case 'p': return PieceTypes::BLACK_PAWN;
+            case 'n': return PieceTypes::BLACK_KNIGHT;
+            case 'b': return PieceTypes::BLACK_BISHOP;
+            case 'r': return PieceTypes::BLACK_ROOK;
+            case 'q': return PieceTypes::BLACK_QUEEN;
+            case 'k': return PieceTypes::BLACK_KING;
+            default: return PieceTypes::EMPTY;
+            }
+        }
+
+        //used where the check flags can't come from move generation, like a position set up from a fen
+        bool isKingAttacked(bool white) const
+        {
+            uint64_t king = m_bitBoard.getPieceMask(white ? PieceTypes::WHITE_KING : PieceTypes::BLACK_KING);
+            if (!king)
+                return false;
+
+            int square = std::countr_zero(king);
+            uint64_t occupancy = m_bitBoard.getAllPieces();
+            int enemy = white ? 6 : 0; //offset of the enemy's piece types
+            auto enemyMask = [this, enemy](PieceTypes type) {
+                return m_bitBoard.getPieceMask(static_cast<PieceTypes>(static_cast<int>(type) + enemy));
+            };
+
+            uint64_t pawnAttackers = white ?
+                ((king & ~FILE_A) << 7 | (king & ~FILE_H) << 9) :
+                ((king & ~FILE_A) >> 9 | (king & ~FILE_H) >> 7);
+            uint64_t diagonal = enemyMask(PieceTypes::WHITE_BISHOP) | enemyMask(PieceTypes::WHITE_QUEEN);
+            uint64_t straight = enemyMask(PieceTypes::WHITE_ROOK) | enemyMask(PieceTypes::WHITE_QUEEN);
+
+            return (pawnAttackers & enemyMask(PieceTypes::WHITE_PAWN)) ||
+                (KNIGHT_ATTACKS[square] & enemyMask(PieceTypes::WHITE_KNIGHT)) ||
+                (KING_ATTACKS[square] & enemyMask(PieceTypes::WHITE_KING)) ||
+                (MagicBishops::getAttacks(square, occupancy) & diagonal) ||
+                (MagicRooks::getAttacks(square, occupancy) & straight);
+        }
+
+        inline uint64_t castlingKey() const
+        {
+            return ZOBRIST.castling[(m_flags.raw() >> CASTLING_RIGHTS_SHIFT) & CASTLING_RIGHTS_MASK];
+        }
+
+        inline uint64_t enPassantKey() const
+        {
+            return m_enPassantMask ? ZOBRIST.enPassantFile[std::countr_zero(m_enPassantMask) % 8] : 0;
+        }
 
     public:
         inline const BitBoard& getBitBoard() const { return m_bitBoard; };
@@ -205,6 +559,42 @@ namespace Chess
         bool isWhiteChecked() const { return m_flags.has(Flags::WHITE_CHECKED); };
         bool isBlackChecked() const { return m_flags.has(Flags::BLACK_CHECKED); };
 
+        inline uint64_t getKey() const { return m_key; };
+        inline uint64_t getPawnKey() const { return m_pawnKey; };
+        inline uint16_t getHalfmoveClock() const { return m_halfmoveClock; };
+        inline Score getPieceSquareScore() const { return m_pieceSquareScore; };
+        inline int getPhase() const { return m_phase; };
+        inline uint64_t getMaterialKey() const { return m_materialKey; };
+        inline void setHalfmoveClock(uint16_t halfmoveClock) { m_halfmoveClock = halfmoveClock; };
+
+        bool isFiftyMoveDraw() const { return m_halfmoveClock >= FIFTY_MOVE_RULE_PLIES; };
+
+        //neither side can mate whatever is played: bare kings, a single minor piece,
+        //or one bishop each on squares of the same colour
+        bool isInsufficientMaterial() const
+        {
+            uint64_t heavyAndPawns = materialKeyUnit(PieceTypes::WHITE_PAWN) + materialKeyUnit(PieceTypes::WHITE_ROOK) +
+                materialKeyUnit(PieceTypes::WHITE_QUEEN) + materialKeyUnit(PieceTypes::BLACK_PAWN) +
+                materialKeyUnit(PieceTypes::BLACK_ROOK) + materialKeyUnit(PieceTypes::BLACK_QUEEN);
+            if (m_materialKey & heavyAndPawns * MATERIAL_COUNT_MASK)
+                return false;
+
+            int whiteKnights = materialCount(m_materialKey, PieceTypes::WHITE_KNIGHT);
+            int whiteBishops = materialCount(m_materialKey, PieceTypes::WHITE_BISHOP);
+            int blackKnights = materialCount(m_materialKey, PieceTypes::BLACK_KNIGHT);
+            int blackBishops = materialCount(m_materialKey, PieceTypes::BLACK_BISHOP);
+            int minors = whiteKnights + whiteBishops + blackKnights + blackBishops;
+            if (minors <= 1)
+                return true;
+
+            if (minors == 2 && whiteBishops == 1 && blackBishops == 1) {
+                bool whiteDark = m_bitBoard.getPieceMask(PieceTypes::WHITE_BISHOP) & DARK_SQUARES;
+                bool blackDark = m_bitBoard.getPieceMask(PieceTypes::BLACK_BISHOP) & DARK_SQUARES;
+                return whiteDark == blackDark;
+            }
+            return false;
+        }
+
         Board() : m_bitBoard(), m_enPassantMask(0), m_flags() {};
 
         Board(const Board&) = default;
@@ -238,6 +628,190 @@ namespace Chess
                 
             // Reset en passant square
             m_enPassantMask = 0;
+            m_halfmoveClock = 0;
+            computeState(true);
+        }
+
+        //sets up a position from Forsyth-Edwards notation, the move counters are optional.
+        //the side to move isn't stored in the board, it's returned through whiteToMove
+        static std::optional<Board> fromFen(const std::string& fen, bool& whiteToMove)
+        {
+            std::istringstream stream(fen);
+            std::string placement, side, castling = "-", enPassant = "-";
+            int halfmoveClock = 0;
+            if (!(stream >> placement >> side))
+                return std::nullopt;
+            stream >> castling >> enPassant >> halfmoveClock;
+
+            Board board;
+            int rank = 7, file = 0;
+            for (char c : placement)
+            {
+                if (c == '/') {
+                    rank--;
+                    file = 0;
+                }
+                else if (c >= '1' && c <= '8')
+                    file += c - '0';
+                else {
+                    PieceTypes type = pieceFromFen(c);
+                    if (type == PieceTypes::EMPTY || rank < 0 || file > 7)
+                        return std::nullopt;
+                    board.m_bitBoard.getPieceMask(type) |= 1ULL << (rank * 8 + file);
+                    file++;
+                }
+            }
+
+            if (side != "w" && side != "b")
+                return std::nullopt;
+            whiteToMove = side == "w";
+
+            for (char c : castling)
+            {
+                switch (c)
+                {
+                case 'K': board.m_flags.set(Flags::WHITE_HAS_CASTLING_KINGSIDE_RIGHTS); break;
+                case 'Q': board.m_flags.set(Flags::WHITE_HAS_CASTLING_QUEENSIDE_RIGHTS); break;
+                case 'k': board.m_flags.set(Flags::BLACK_HAS_CASTLING_KINGSIDE_RIGHTS); break;
+                case 'q': board.m_flags.set(Flags::BLACK_HAS_CASTLING_QUEENSIDE_RIGHTS); break;
+                default: break;
+                }
+            }
+
+            if (enPassant.size() == 2 && enPassant[0] >= 'a' && enPassant[0] <= 'h' &&
+                enPassant[1] >= '1' && enPassant[1] <= '8')
+                board.m_enPassantMask = 1ULL << ((enPassant[1] - '1') * 8 + enPassant[0] - 'a');
+
+            if (board.isKingAttacked(true))
+                board.m_flags.set(Flags::WHITE_CHECKED);
+            if (board.isKingAttacked(false))
+                board.m_flags.set(Flags::BLACK_CHECKED);
+
+            board.m_halfmoveClock = static_cast<uint16_t>(halfmoveClock);
+            board.computeState(whiteToMove);
+            return board;
+        }
+
+        //full computation of the incrementally kept state (key and material),
+        //used when a position is set up instead of reached by a move
+        void computeState(bool whiteToMove)
+        {
+            m_key = 0;
+            m_pawnKey = 0;
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+            {
+                uint64_t mask = m_bitBoard.getPieceMask(static_cast<PieceTypes>(i));
+                while (mask)
+                {
+                    m_key ^= ZOBRIST.pieces[i - 1][std::countr_zero(mask)];
+                    if (isPawn(i))
+                        m_pawnKey ^= ZOBRIST.pieces[i - 1][std::countr_zero(mask)];
+                    mask &= mask - 1;
+                }
+            }
+            m_key ^= castlingKey() ^ enPassantKey();
+            if (!whiteToMove)
+                m_key ^= ZOBRIST.blackToMove;
+
+            m_pieceSquareScore = computePieceSquareScore();
+            m_phase = computePhase();
+            m_materialKey = computeMaterialKey();
+        }
+
+        //material and piece-square sum recomputed from scratch, the incremental value must always match it
+        Score computePieceSquareScore() const
+        {
+            Score score = 0;
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+            {
+                uint64_t mask = m_bitBoard.getPieceMask(static_cast<PieceTypes>(i));
+                while (mask)
+                {
+                    score += evalParameters().pieceScores[i][std::countr_zero(mask)];
+                    mask &= mask - 1;
+                }
+            }
+            return score;
+        }
+
+        uint8_t computePhase() const
+        {
+            int phase = 0;
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+                phase += PHASE_WEIGHTS[i] * std::popcount(m_bitBoard.getPieceMask(static_cast<PieceTypes>(i)));
+            return static_cast<uint8_t>(phase);
+        }
+
+        uint64_t computeMaterialKey() const
+        {
+            uint64_t materialKey = 0;
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+                materialKey += materialKeyUnit(static_cast<PieceTypes>(i)) *
+                    std::popcount(m_bitBoard.getPieceMask(static_cast<PieceTypes>(i)));
+            return materialKey;
+        }
+
+        //derives the incremental state of a freshly generated board from the board the move was made on,
+        //key, material and phase are updated from the piece masks that changed so every move type is covered
+        void updateState(const Board& previous)
+        {
+            m_key = previous.m_key ^ ZOBRIST.blackToMove ^
+                previous.castlingKey() ^ castlingKey() ^
+                previous.enPassantKey() ^ enPassantKey();
+
+            m_pawnKey = previous.m_pawnKey;
+            m_pieceSquareScore = previous.m_pieceSquareScore;
+            m_phase = previous.m_phase;
+            m_materialKey = previous.m_materialKey;
+
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+            {
+                uint64_t mask = m_bitBoard.getPieceMask(static_cast<PieceTypes>(i));
+                uint64_t changed = mask ^ previous.m_bitBoard.getPieceMask(static_cast<PieceTypes>(i));
+                while (changed)
+                {
+                    int square = std::countr_zero(changed);
+                    m_key ^= ZOBRIST.pieces[i - 1][square];
+                    if (isPawn(i))
+                        m_pawnKey ^= ZOBRIST.pieces[i - 1][square];
+                    if (mask >> square & 1)
+                    {
+                        m_pieceSquareScore += evalParameters().pieceScores[i][square];
+                        m_phase += PHASE_WEIGHTS[i];
+                        m_materialKey += materialKeyUnit(static_cast<PieceTypes>(i));
+                    }
+                    else
+                    {
+                        m_pieceSquareScore -= evalParameters().pieceScores[i][square];
+                        m_phase -= PHASE_WEIGHTS[i];
+                        m_materialKey -= materialKeyUnit(static_cast<PieceTypes>(i));
+                    }
+                    changed &= changed - 1;
+                }
+            }
+
+            PieceTypes moved = m_lastMove.getMovedPiece();
+            if (m_lastMove.hasFlag(Move::Flags::CAPTURE) ||
+                moved == PieceTypes::WHITE_PAWN || moved == PieceTypes::BLACK_PAWN)
+                m_halfmoveClock = 0;
+            else m_halfmoveClock = previous.m_halfmoveClock + 1;
+        }
+
+        //checks if the key appears in the history often enough, only positions with the same side
+        //to move inside the reversible part of the history (halfmove clock) are compared.
+        //the history must end with the position the key's position was reached from
+        static bool isRepetition(const std::vector<uint64_t>& keyHistory, uint64_t key,
+            size_t halfmoveClock, int repetitions = 1)
+        {
+            int count = 0;
+            size_t size = keyHistory.size();
+            size_t end = std::min(halfmoveClock, size);
+            for (size_t distance = 4; distance <= end; distance += 2)
+            {
+                if (keyHistory[size - distance] == key && ++count >= repetitions)
+                    return true;
+            }
+            return false;
         }
 
         PieceTypes getPieceAtSquare(int square) const {
@@ -285,29 +859,43 @@ namespace Chess
     public:
 
         static std::vector<Board> getNextBoardsWhite(const Board& currentBoard) {
-            int i = 0;
             std::vector<Board> nextBoards;
             nextBoards.reserve(MAXIMUM_CONSERVATIVE_MOVE_AMOUNT);
+            getNextBoardsWhite(currentBoard, nextBoards);
+            return nextBoards;
+        }
+
+        //replaces the content of nextBoards, which doesn't allocate once its capacity fits every move
+        static void getNextBoardsWhite(const Board& currentBoard, std::vector<Board>& nextBoards) {
+            nextBoards.clear();
             getWhitePawnMoves(currentBoard, nextBoards);
             getWhiteKnightMoves(currentBoard, nextBoards);
             getWhiteBishopMoves(currentBoard, nextBoards);
             getWhiteRookMoves(currentBoard, nextBoards);
             getWhiteQueenMoves(currentBoard, nextBoards);
             getWhiteKingMoves(currentBoard, nextBoards);
-            return nextBoards;
+            for (auto& nextBoard : nextBoards)
+                nextBoard.updateState(currentBoard);
         }
 
         static std::vector<Board> getNextBoardsBlack(const Board& currentBoard) {
-            int i = 0;
             std::vector<Board> nextBoards;
             nextBoards.reserve(MAXIMUM_CONSERVATIVE_MOVE_AMOUNT);
+            getNextBoardsBlack(currentBoard, nextBoards);
+            return nextBoards;
+        }
+
+        //replaces the content of nextBoards, which doesn't allocate once its capacity fits every move
+        static void getNextBoardsBlack(const Board& currentBoard, std::vector<Board>& nextBoards) {
+            nextBoards.clear();
             getBlackPawnMoves(currentBoard, nextBoards);
             getBlackKnightMoves(currentBoard, nextBoards);
             getBlackBishopMoves(currentBoard, nextBoards);
             getBlackRookMoves(currentBoard, nextBoards);
             getBlackQueenMoves(currentBoard, nextBoards);
             getBlackKingMoves(currentBoard, nextBoards);
-            return nextBoards;
+            for (auto& nextBoard : nextBoards)
+                nextBoard.updateState(currentBoard);
         }
 
         static std::unordered_multimap<int, Board> getNextBoardsWhiteMultimap(const Board& currentBoard) {
@@ -323,6 +911,9 @@ namespace Chess
 
             std::unordered_multimap<int, Board> nextMap;
 
+            for (auto& nextBoard : nextBoards)
+                nextBoard.updateState(currentBoard);
+
             for (auto& nextBoard : nextBoards)
                 nextMap.insert(std::make_pair(nextBoard.getLastMove().fromSquare, std::move(nextBoard)));
 
@@ -342,6 +933,9 @@ namespace Chess
 
             std::unordered_multimap<int, Board> nextMap;
 
+            for (auto& nextBoard : nextBoards)
+                nextBoard.updateState(currentBoard);
+
             for (auto& nextBoard : nextBoards)
                 nextMap.insert(std::make_pair(nextBoard.getLastMove().fromSquare, std::move(nextBoard)));
 
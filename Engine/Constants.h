@@ -57,7 +57,7 @@ namespace Chess
     static inline const size_t MAXIMUM_CONSERVATIVE_MOVE_AMOUNT = 50; //may be higher but its unlikely
 
     // Piece-square tables (from white's perspective)
-    static inline const std::array<int, 64> emptyTable = {
+    constexpr std::array<int, 64> emptyTable = {
     0,  0,  0,  0,  0,  0,  0,  0,
     0,  0,  0,  0,  0,  0,  0,  0,
     0,  0,  0,  0,  0,  0,  0,  0,
@@ -68,7 +68,7 @@ namespace Chess
     0,  0,  0,  0,  0,  0,  0,  0,
     };
 
-    static inline const std::array<int, 64> whitePawnTable = {
+    constexpr std::array<int, 64> whitePawnTable = {
         0,  0,  0,  0,  0,  0,  0,  0,
         5,  10, 10,-20,-20, 10, 10, 5,
         5,  -5,-10,  0,  0,-10, -5, 5,
@@ -79,7 +79,7 @@ namespace Chess
         0,  0,  0,  0,  0,  0,  0,  0
     };
 
-    static inline const std::array<int, 64> whiteKnightTable = {
+    constexpr std::array<int, 64> whiteKnightTable = {
         -50,-40,-30,-30,-30,-30,-40,-50,
         -40,-20,  0,  5,  5,  0,-20,-40,
         -30,  5, 10, 15, 15, 10,  5,-30,
@@ -90,7 +90,7 @@ namespace Chess
         -50,-40,-30,-30,-30,-30,-40,-50
     };
 
-    static inline const std::array<int, 64> whiteBishopTable = {
+    constexpr std::array<int, 64> whiteBishopTable = {
         -20,-10,-10,-10,-10,-10,-10,-20,
         -10,  5,  0,  0,  0,  0,  5,-10,
         -10, 10, 10, 10, 10, 10, 10,-10,
@@ -101,7 +101,7 @@ namespace Chess
         -20,-10,-10,-10,-10,-10,-10,-20
     };
 
-    static inline const std::array<int, 64> whiteRookTable = {
+    constexpr std::array<int, 64> whiteRookTable = {
         0,  0,  0,  5,  5,  0,  0,  0,
         -5,  0,  0,  0,  0,  0,  0, -5,
         -5,  0,  0,  0,  0,  0,  0, -5,
@@ -112,7 +112,7 @@ namespace Chess
         0,  0,  0,  0,  0,  0,  0,  0
     };
 
-    static inline const std::array<int, 64> whiteQueenTable = {
+    constexpr std::array<int, 64> whiteQueenTable = {
         -20,-10,-10, -5, -5,-10,-10,-20,
         -10,  0,  0,  0,  0,  5,  0,-10,
         -10,  0,  5,  5,  5,  5,  5,-10,
@@ -123,7 +123,7 @@ namespace Chess
         -20,-10,-10, -5, -5,-10,-10,-20
     };
 
-    static inline const std::array<int, 64> whiteKingTable = {
+    constexpr std::array<int, 64> whiteKingTable = {
         20, 30, 10,  0,  0, 10, 30, 20,
         20, 20,  0,  0,  0,  0, 20, 20,
         -10,-20,-20,-20,-20,-20,-20,-10,
@@ -134,72 +134,37 @@ namespace Chess
         -30,-40,-40,-50,-50,-40,-40,-30
     };
 
-    static inline const std::array<int, 64> blackPawnTable = {
-            0,  0,  0,  0,  0,  0,  0,  0,
-            -50,-50,-50,-50,-50,-50,-50,-50,
-            -10,-10,-20,-30,-30,-20,-10,-10,
-            -5, -5,-10,-25,-25,-10, -5, -5,
-            0,  0,  0,-20,-20,  0,  0,  0,
-            -5,  5, 10,  0,  0, 10,  5, -5,
-            -5,-10,-10, 20, 20,-10,-10, -5,
-            0,  0,  0,  0,  0,  0,  0,  0
-    };
-
-    static inline const std::array<int, 64> blackKnightTable = {
-        50, 40, 30, 30, 30, 30, 40, 50,
-        40, 20,  0,  0,  0,  0, 20, 40,
-        30,  0,-10,-15,-15,-10,  0, 30,
-        30, -5,-15,-20,-20,-15, -5, 30,
-        30,  0,-15,-20,-20,-15,  0, 30,
-        30, -5,-10,-15,-15,-10, -5, 30,
-        40, 20,  0, -5, -5,  0, 20, 40,
-        50, 40, 30, 30, 30, 30, 40, 50
-    };
-
-    static inline const std::array<int, 64> blackBishopTable = {
-        20, 10, 10, 10, 10, 10, 10, 20,
-        10,  0,  0,  0,  0,  0,  0, 10,
-        10,  0, -5,-10,-10, -5,  0, 10,
-        10, -5, -5,-10,-10, -5, -5, 10,
-        10,  0,-10,-10,-10,-10,  0, 10,
-        10,-10,-10,-10,-10,-10,-10, 10,
-        10, -5,  0,  0,  0,  0, -5, 10,
-        20, 10, 10, 10, 10, 10, 10, 20
-    };
-
-    static inline const std::array<int, 64> blackRookTable = {
+    // Endgame piece-square tables (from white's perspective), pieces without one use their midgame table
+    constexpr std::array<int, 64> whitePawnEndgameTable = {
         0,  0,  0,  0,  0,  0,  0,  0,
-        -5,-10,-10,-10,-10,-10,-10, -5,
-        5,  0,  0,  0,  0,  0,  0,  5,
-        5,  0,  0,  0,  0,  0,  0,  5,
-        5,  0,  0,  0,  0,  0,  0,  5,
-        5,  0,  0,  0,  0,  0,  0,  5,
-        5,  0,  0,  0,  0,  0,  0,  5,
-        0,  0,  0, -5, -5,  0,  0,  0
-    };
-
-    static inline const std::array<int, 64> blackQueenTable = {
-        20, 10, 10,  5,  5, 10, 10, 20,
-        10,  0,  0,  0,  0,  0,  0, 10,
-        10,  0, -5, -5, -5, -5,  0, 10,
-        5,  0, -5, -5, -5, -5,  0,  5,
-        0,  0, -5, -5, -5, -5,  0,  5,
-        10,  0, -5, -5, -5, -5, -5, 10,
-        10,  0,  0,  0,  0, -5,  0, 10,
-        20, 10, 10,  5,  5, 10, 10, 20
+        0,  0,  0,  0,  0,  0,  0,  0,
+        5,  5,  5,  5,  5,  5,  5,  5,
+        10, 10, 10, 10, 10, 10, 10, 10,
+        20, 20, 20, 20, 20, 20, 20, 20,
+        35, 35, 35, 35, 35, 35, 35, 35,
+        60, 60, 60, 60, 60, 60, 60, 60,
+        0,  0,  0,  0,  0,  0,  0,  0
     };
 
-    static inline const std::array<int, 64> blackKingTable = {
-        30, 40, 40, 50, 50, 40, 40, 30,
-        30, 40, 40, 50, 50, 40, 40, 30,
-        30, 40, 40, 50, 50, 40, 40, 30,
-        30, 40, 40, 50, 50, 40, 40, 30,
-        20, 30, 30, 40, 40, 30, 30, 20,
-        10, 20, 20, 20, 20, 20, 20, 10,
-        -20,-20,  0,  0,  0,  0,-20,-20,
-        -20,-30,-10,  0,  0,-10,-30,-20
+    constexpr std::array<int, 64> whiteKingEndgameTable = {
+        -50,-30,-30,-30,-30,-30,-30,-50,
+        -30,-30,  0,  0,  0,  0,-30,-30,
+        -30,-10, 20, 30, 30, 20,-10,-30,
+        -30,-10, 30, 40, 40, 30,-10,-30,
+        -30,-10, 30, 40, 40, 30,-10,-30,
+        -30,-10, 20, 30, 30, 20,-10,-30,
+        -30,-20,-10,  0,  0,-10,-20,-30,
+        -50,-40,-30,-20,-20,-30,-40,-50
     };
 
+    // black tables are the white ones flipped vertically with the sign inverted
+    constexpr std::array<int, 64> mirrorTableForBlack(const std::array<int, 64>& table)
+    {
+        std::array<int, 64> mirrored = { 0 };
+        for (int square = 0; square < 64; square++)
+            mirrored[square] = -table[square ^ 56];
+        return mirrored;
+    }
 
     // Pre-calculated lookup tables
     constexpr std::array<uint64_t, 64> KNIGHT_ATTACKS = []()->std::array<uint64_t, 64> {
@@ -297,6 +262,41 @@ namespace Chess
         return attacks;
         }();
 
+    // Zobrist keys, generated with splitmix64 from a fixed seed so keys are stable between builds
+    constexpr uint64_t splitMix64(uint64_t& state)
+    {
+        uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    struct ZobristKeys
+    {
+        std::array<std::array<uint64_t, 64>, 12> pieces; //indexed like the bitboard, without the empty piece
+        std::array<uint64_t, 16> castling;  //indexed by the 4 castling rights bits
+        std::array<uint64_t, 8> enPassantFile;
+        uint64_t blackToMove;
+    };
+
+    constexpr ZobristKeys ZOBRIST = []()->ZobristKeys {
+        ZobristKeys keys = {};
+        uint64_t state = 0x2545F4914F6CDD1DULL;
+        for (auto& pieceKeys : keys.pieces)
+            for (auto& key : pieceKeys)
+                key = splitMix64(state);
+        for (auto& key : keys.castling)
+            key = splitMix64(state);
+        keys.castling[0] = 0;
+        for (auto& key : keys.enPassantFile)
+            key = splitMix64(state);
+        keys.blackToMove = splitMix64(state);
+        return keys;
+        }();
+
+    // Draw rules
+    static inline const size_t FIFTY_MOVE_RULE_PLIES = 100;
+
     static inline const uint64_t RANK_1 = 0x00000000000000FFULL; //white start here, its down, x = 0
     static inline const uint64_t RANK_2 = 0x000000000000FF00ULL;
     static inline const uint64_t RANK_3 = 0x0000000000FF0000ULL;
@@ -315,6 +315,8 @@ namespace Chess
     static inline const uint64_t FILE_G = 0x4040404040404040ULL; // file G (seventh bit from right)
     static inline const uint64_t FILE_H = 0x8080808080808080ULL; // file H (leftmost bit in each byte)
 
+    static inline const uint64_t DARK_SQUARES = 0xAA55AA55AA55AA55ULL; // a1, c1, ... b2, d2, ...
+
     // Starting position masks for rooks
     static inline const uint64_t WHITE_ROOK_KINGSIDE_START = 0x0000000000000080ULL;  // h1
     static inline const uint64_t WHITE_ROOK_QUEENSIDE_START = 0x0000000000000001ULL;  // a1
@@ -0,0 +1,176 @@
+#pragma once
+#include <string_view>
+#include <unordered_map>
+#include <bit>
+
+#include "Chess.h"
+
+namespace Chess
+{
+    // Specialised evaluation of known endgames, looked up by the board's material key.
+    // An endgame either replaces the evaluation entirely or scales the regular one towards a draw
+    class Endgames
+    {
+    public:
+        // returns the score from white's perspective, strongIsWhite tells which side the signature's first king is
+        using EvaluationFunction = int(*)(const Board& board, bool strongIsWhite);
+        // returns the factor the regular evaluation is multiplied by, SCALE_NORMAL leaves it as is
+        using ScaleFunction = int(*)(const Board& board, bool strongIsWhite);
+
+        struct Entry
+        {
+            EvaluationFunction evaluate = nullptr;
+            ScaleFunction scale = nullptr;
+            bool strongIsWhite = true;
+        };
+
+        static inline const int SCALE_NORMAL = 64;
+        static inline const int KNOWN_WIN = 1000; // on top of the material, still far from a mate score
+
+        // only positions with this little material left can have an entry, checked before the lookup
+        static inline int getMaxPhase() { return table().maxPhase; };
+
+        static const Entry* probe(uint64_t materialKey)
+        {
+            const auto& entries = table().entries;
+            auto it = entries.find(materialKey);
+            return it != entries.end() ? &it->second : nullptr;
+        }
+
+        // material key of the pieces written as in "KRK", the first king's pieces belong to white
+        static uint64_t makeMaterialKey(std::string_view signature, bool strongIsWhite = true)
+        {
+            uint64_t key = 0;
+            size_t weakStart = signature.find('K', 1);
+            for (size_t i = 0; i < signature.size(); i++)
+            {
+                bool white = (i < weakStart) == strongIsWhite;
+                key += materialKeyUnit(pieceFromLetter(signature[i], white));
+            }
+            return key;
+        }
+
+    private:
+        struct Table
+        {
+            std::unordered_map<uint64_t, Entry> entries;
+            int maxPhase = 0;
+        };
+
+        static const Table& table()
+        {
+            static const Table instance = []() {
+                Table table;
+                auto add = [&table](std::string_view signature, EvaluationFunction evaluate, ScaleFunction scale) {
+                    for (bool strongIsWhite : { true, false })
+                    {
+                        uint64_t key = makeMaterialKey(signature, strongIsWhite);
+                        table.entries[key] = { evaluate, scale, strongIsWhite };
+                        table.maxPhase = std::max(table.maxPhase, phaseOf(key));
+                    }
+                };
+
+                add("KQK", evaluateKXK, nullptr);
+                add("KRK", evaluateKXK, nullptr);
+                add("KBNK", evaluateKBNK, nullptr);
+                add("KRKB", nullptr, scaleDrawish);
+                add("KRKN", nullptr, scaleDrawish);
+                add("KNNK", nullptr, scaleDraw);
+                return table;
+                }();
+            return instance;
+        }
+
+        static PieceTypes pieceFromLetter(char letter, bool white)
+        {
+            PieceTypes type;
+            switch (letter)
+            {
+            case 'P': type = PieceTypes::WHITE_PAWN; break;
+            case 'N': type = PieceTypes::WHITE_KNIGHT; break;
+            case 'B': type = PieceTypes::WHITE_BISHOP; break;
+            case 'R': type = PieceTypes::WHITE_ROOK; break;
+            case 'Q': type = PieceTypes::WHITE_QUEEN; break;
+            default: type = PieceTypes::WHITE_KING; break;
+            }
+            return white ? type : static_cast<PieceTypes>(static_cast<int>(type) + 6);
+        }
+
+        static int phaseOf(uint64_t materialKey)
+        {
+            int phase = 0;
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+                phase += PHASE_WEIGHTS[i] * materialCount(materialKey, static_cast<PieceTypes>(i));
+            return phase;
+        }
+
+        static int material(uint64_t materialKey)
+        {
+            int value = 0;
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+                value += evalParameters().signedPieceValues[i] * materialCount(materialKey, static_cast<PieceTypes>(i));
+            return value;
+        }
+
+        static inline int manhattanDistance(int a, int b)
+        {
+            return std::abs(a / 8 - b / 8) + std::abs(a % 8 - b % 8);
+        }
+
+        // 0 on the four centre squares, 6 in the corners
+        static inline int centerDistance(int square)
+        {
+            int file = square % 8, rank = square / 8;
+            return std::max(3 - file, file - 4) + std::max(3 - rank, rank - 4);
+        }
+
+        static inline int kingSquare(const Board& board, bool white)
+        {
+            return std::countr_zero(board.getBitBoard().getPieceMask(
+                white ? PieceTypes::WHITE_KING : PieceTypes::BLACK_KING));
+        }
+
+        // mating material against a bare king: drive the king to the edge and bring the own king closer
+        static int evaluateKXK(const Board& board, bool strongIsWhite)
+        {
+            int strongKing = kingSquare(board, strongIsWhite);
+            int weakKing = kingSquare(board, !strongIsWhite);
+
+            int score = KNOWN_WIN + std::abs(material(board.getMaterialKey()));
+            score += 47 * centerDistance(weakKing);
+            score += 16 * (14 - manhattanDistance(strongKing, weakKing));
+            return strongIsWhite ? score : -score;
+        }
+
+        // bishop and knight: the mate is only possible in a corner of the bishop's colour
+        static int evaluateKBNK(const Board& board, bool strongIsWhite)
+        {
+            int strongKing = kingSquare(board, strongIsWhite);
+            int weakKing = kingSquare(board, !strongIsWhite);
+            uint64_t bishop = board.getBitBoard().getPieceMask(
+                strongIsWhite ? PieceTypes::WHITE_BISHOP : PieceTypes::BLACK_BISHOP);
+
+            bool darkBishop = bishop & DARK_SQUARES;
+            int cornerDistance = darkBishop ?
+                std::min(manhattanDistance(weakKing, 0), manhattanDistance(weakKing, 63)) :   // a1, h8
+                std::min(manhattanDistance(weakKing, 7), manhattanDistance(weakKing, 56));    // h1, a8
+
+            int score = KNOWN_WIN + std::abs(material(board.getMaterialKey()));
+            score += 20 * (14 - cornerDistance);
+            score += 16 * (14 - manhattanDistance(strongKing, weakKing));
+            return strongIsWhite ? score : -score;
+        }
+
+        // a rook against a minor piece is usually held
+        static int scaleDrawish(const Board&, bool)
+        {
+            return SCALE_NORMAL / 4;
+        }
+
+        // two knights can't force a mate
+        static int scaleDraw(const Board&, bool)
+        {
+            return 0;
+        }
+    };
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <vector>
+#include <algorithm>
+
+#include "Chess.h"
+
+namespace Chess
+{
+    // Caches full evaluations by the board's key. Each entry is a single word holding the upper half
+    // of the key as verification bits and the score, so a torn write can't mix two positions even if
+    // the table were shared between threads. Scores are stored from white's perspective
+    class EvalCache
+    {
+    public:
+        static inline const size_t DEFAULT_SIZE = 1 << 16; //entries, must be a power of two
+        static inline const size_t ENTRY_SIZE = sizeof(uint64_t); //bytes
+
+    private:
+        std::vector<uint64_t> m_entries; // 0 marks an empty entry
+        size_t m_mask;
+        size_t m_probes = 0;
+        size_t m_hits = 0;
+
+        static inline uint64_t pack(uint64_t key, int score)
+        {
+            return (key & 0xFFFFFFFF00000000ULL) | static_cast<uint32_t>(score);
+        }
+
+    public:
+        EvalCache(size_t size = DEFAULT_SIZE) : m_entries(size, 0), m_mask(size - 1) {};
+
+        bool probe(uint64_t key, int& score)
+        {
+            uint64_t entry = m_entries[key & m_mask];
+            m_probes++;
+
+            if (entry == 0 || (entry ^ key) >> 32)
+                return false;
+
+            m_hits++;
+            score = static_cast<int32_t>(static_cast<uint32_t>(entry));
+            return true;
+        }
+
+        void store(uint64_t key, int score)
+        {
+            m_entries[key & m_mask] = pack(key, score);
+        }
+
+        size_t getSize() const { return m_entries.size(); };
+        size_t getProbes() const { return m_probes; };
+        size_t getHits() const { return m_hits; };
+
+        // occupied entries per mille, estimated from the first thousand entries
+        int getHashfull() const
+        {
+            size_t sample = std::min<size_t>(1000, m_entries.size());
+            size_t used = std::count_if(m_entries.begin(), m_entries.begin() + sample,
+                [](uint64_t entry) { return entry != 0; });
+            return static_cast<int>(used * 1000 / sample);
+        }
+
+        void resetStatistics()
+        {
+            m_probes = 0;
+            m_hits = 0;
+        }
+
+        void clear()
+        {
+            std::fill(m_entries.begin(), m_entries.end(), 0);
+            resetStatistics();
+        }
+    };
+}
@@ -0,0 +1,356 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <functional>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+#include <optional>
+
+#include "Chess.h"
+#include "Ai.h"
+#include "BenchPositions.h"
+
+namespace Chess
+{
+    // Times the engine's building blocks in isolation over the bench positions, so a slowdown can be traced
+    // to a single component. Every benchmark is warmed up, then timed over repeated runs, each run repeating
+    // the benchmark's pass over its inputs until it lasts long enough for the clock. The ns per operation of
+    // every run is kept as a sample for the statistics and the JSON report
+    class MicroBenchmarks
+    {
+    public:
+        struct Options
+        {
+            size_t warmupRuns = 3;
+            size_t runs = 30;
+            std::chrono::microseconds minRunTime{ 2000 };
+        };
+
+        struct Result
+        {
+            std::string name;
+            size_t operationsPerRun = 0;
+            std::vector<double> samples; // ns per operation, one per run
+            double median = 0.0;
+            double p10 = 0.0;
+            double p90 = 0.0;
+            double mean = 0.0;
+            double stddev = 0.0;
+            double min = 0.0;
+            double max = 0.0;
+        };
+
+    private:
+        // runs the benchmark's inputs once, returns the number of operations it did
+        using Pass = std::function<size_t()>;
+
+        struct Benchmark
+        {
+            std::string name;
+            Pass pass;
+        };
+
+        Options m_options;
+        std::vector<Board> m_positions;
+        std::vector<bool> m_sides; // side to move of every position
+        std::vector<std::vector<Board>> m_moves; // legal moves of every position, as generated
+        std::vector<Board> m_buffer; // move generation output, reused by every pass
+        std::vector<Board> m_copies;
+        std::unique_ptr<Ai> m_ai;
+        std::vector<Benchmark> m_benchmarks;
+        std::vector<Result> m_results;
+        uint64_t m_sink = 0; // every pass folds its outputs in here so they can't be optimised away
+
+    public:
+        MicroBenchmarks() : MicroBenchmarks(Options()) {};
+
+        MicroBenchmarks(const Options& options) : m_options(options), m_ai(std::make_unique<Ai>())
+        {
+            for (const char* fen : BENCH_POSITIONS)
+            {
+                bool isWhite;
+                auto board = Board::fromFen(fen, isWhite);
+                if (!board)
+                    continue;
+                m_positions.push_back(*board);
+                m_sides.push_back(isWhite);
+                m_moves.push_back(isWhite ? Calculator::getNextBoardsWhite(*board) : Calculator::getNextBoardsBlack(*board));
+            }
+            m_buffer.reserve(SearchStack::MAX_MOVES);
+            m_copies.resize(m_positions.size());
+            m_ai->reset(m_sides.front(), 1);
+            m_ai->getBestMove(m_positions.front()); // allocates the search stack, move ordering reads its killers
+            registerBenchmarks();
+        }
+
+        // runs the benchmarks whose name contains the filter, all of them for an empty one
+        const std::vector<Result>& run(const std::string& filter = "")
+        {
+            m_results.clear();
+            for (const auto& benchmark : m_benchmarks)
+            {
+                if (benchmark.name.find(filter) == std::string::npos)
+                    continue;
+                m_results.push_back(measure(benchmark));
+                print(m_results.back());
+            }
+            volatile uint64_t sink = m_sink;
+            (void)sink;
+            return m_results;
+        }
+
+        const std::vector<Result>& getResults() const { return m_results; };
+
+        bool writeJson(const std::string& path) const
+        {
+            return writeJson(path, m_results);
+        }
+
+        // the statistics of the samples, each one the ns per operation of a run
+        static Result summarize(std::string name, size_t operationsPerRun, std::vector<double> samples)
+        {
+            Result result;
+            result.name = std::move(name);
+            result.operationsPerRun = operationsPerRun;
+            result.samples = std::move(samples);
+            if (result.samples.empty())
+                return result;
+
+            std::vector<double> sorted = result.samples;
+            std::sort(sorted.begin(), sorted.end());
+            result.median = percentile(sorted, 0.5);
+            result.p10 = percentile(sorted, 0.1);
+            result.p90 = percentile(sorted, 0.9);
+            result.min = sorted.front();
+            result.max = sorted.back();
+            result.mean = std::accumulate(sorted.begin(), sorted.end(), 0.0) / sorted.size();
+            double variance = 0.0;
+            for (double sample : sorted)
+                variance += (sample - result.mean) * (sample - result.mean);
+            result.stddev = sorted.size() > 1 ? std::sqrt(variance / (sorted.size() - 1)) : 0.0;
+            return result;
+        }
+
+        // linear interpolation between the closest ranks
+        static double percentile(const std::vector<double>& sorted, double fraction)
+        {
+            double rank = fraction * (sorted.size() - 1);
+            size_t lower = static_cast<size_t>(rank);
+            size_t upper = std::min(lower + 1, sorted.size() - 1);
+            return sorted[lower] + (sorted[upper] - sorted[lower]) * (rank - lower);
+        }
+
+        // the results as read by BenchmarkComparison, a search signature is only written when given
+        static bool writeJson(const std::string& path, const std::vector<Result>& results,
+            std::optional<size_t> signature = std::nullopt)
+        {
+            std::ofstream file(path);
+            if (!file) {
+                std::cout << "Could not open " << path << std::endl;
+                return false;
+            }
+
+            file << std::setprecision(6) << std::fixed;
+            file << "{\n  \"unit\": \"ns/op\",\n";
+            if (signature)
+                file << "  \"signature\": " << *signature << ",\n";
+            file << "  \"benchmarks\": [\n";
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                const Result& result = results[i];
+                file << "    {\n";
+                file << "      \"name\": \"" << result.name << "\",\n";
+                file << "      \"operationsPerRun\": " << result.operationsPerRun << ",\n";
+                file << "      \"median\": " << result.median << ",\n";
+                file << "      \"p10\": " << result.p10 << ",\n";
+                file << "      \"p90\": " << result.p90 << ",\n";
+                file << "      \"mean\": " << result.mean << ",\n";
+                file << "      \"stddev\": " << result.stddev << ",\n";
+                file << "      \"min\": " << result.min << ",\n";
+                file << "      \"max\": " << result.max << ",\n";
+                file << "      \"samples\": [";
+                for (size_t j = 0; j < result.samples.size(); j++)
+                    file << (j ? ", " : "") << result.samples[j];
+                file << "]\n    }" << (i + 1 < results.size() ? "," : "") << "\n";
+            }
+            file << "  ]\n}\n";
+            std::cout << "Results written to " << path << std::endl;
+            return true;
+        }
+
+    private:
+        void add(std::string name, Pass pass)
+        {
+            m_benchmarks.push_back({ std::move(name), std::move(pass) });
+        }
+
+        // one benchmark of a single side's generator, over every position
+        void addGenerator(std::string name, void(*generator)(const Board&, std::vector<Board>&))
+        {
+            add(std::move(name), [this, generator]() {
+                for (const auto& board : m_positions)
+                {
+                    m_buffer.clear();
+                    generator(board, m_buffer);
+                    m_sink += m_buffer.size();
+                }
+                return m_positions.size();
+                });
+        }
+
+        void registerBenchmarks()
+        {
+            addGenerator("Calculator::getWhitePawnMoves", Calculator::getWhitePawnMoves);
+            addGenerator("Calculator::getBlackPawnMoves", Calculator::getBlackPawnMoves);
+            addGenerator("Calculator::getWhiteKnightMoves", Calculator::getWhiteKnightMoves);
+            addGenerator("Calculator::getBlackKnightMoves", Calculator::getBlackKnightMoves);
+            addGenerator("Calculator::getWhiteBishopMoves", Calculator::getWhiteBishopMoves);
+            addGenerator("Calculator::getBlackBishopMoves", Calculator::getBlackBishopMoves);
+            addGenerator("Calculator::getWhiteRookMoves", Calculator::getWhiteRookMoves);
+            addGenerator("Calculator::getBlackRookMoves", Calculator::getBlackRookMoves);
+            addGenerator("Calculator::getWhiteQueenMoves", Calculator::getWhiteQueenMoves);
+            addGenerator("Calculator::getBlackQueenMoves", Calculator::getBlackQueenMoves);
+            addGenerator("Calculator::getWhiteKingMoves", Calculator::getWhiteKingMoves);
+            addGenerator("Calculator::getBlackKingMoves", Calculator::getBlackKingMoves);
+
+            // all legal moves of the side to move, with the state of every board updated
+            add("Calculator::getNextBoards", [this]() {
+                for (size_t i = 0; i < m_positions.size(); i++)
+                {
+                    if (m_sides[i])
+                        Calculator::getNextBoardsWhite(m_positions[i], m_buffer);
+                    else Calculator::getNextBoardsBlack(m_positions[i], m_buffer);
+                    m_sink += m_buffer.size();
+                }
+                return m_positions.size();
+                });
+
+            // every square with the occupancy of every position
+            add("MagicBishops::getAttacks", [this]() {
+                for (const auto& board : m_positions)
+                {
+                    uint64_t occupancy = board.getBitBoard().getAllPieces();
+                    for (int square = 0; square < 64; square++)
+                        m_sink ^= MagicBishops::getAttacks(square, occupancy);
+                }
+                return m_positions.size() * 64;
+                });
+
+            add("MagicRooks::getAttacks", [this]() {
+                for (const auto& board : m_positions)
+                {
+                    uint64_t occupancy = board.getBitBoard().getAllPieces();
+                    for (int square = 0; square < 64; square++)
+                        m_sink ^= MagicRooks::getAttacks(square, occupancy);
+                }
+                return m_positions.size() * 64;
+                });
+
+            // every square, against black's pieces
+            add("Calculator::isSquareUnderAttack", [this]() {
+                for (const auto& board : m_positions)
+                {
+                    const auto& bitBoard = board.getBitBoard();
+                    for (int square = 0; square < 64; square++)
+                        m_sink += Calculator::isSquareUnderAttack(board, 1ULL << square, square,
+                            bitBoard.getPieceMask(PieceTypes::BLACK_PAWN),
+                            bitBoard.getPieceMask(PieceTypes::BLACK_KNIGHT),
+                            bitBoard.getPieceMask(PieceTypes::BLACK_BISHOP),
+                            bitBoard.getPieceMask(PieceTypes::BLACK_ROOK),
+                            bitBoard.getPieceMask(PieceTypes::BLACK_QUEEN),
+                            bitBoard.getPieceMask(PieceTypes::BLACK_KING),
+                            Calculator::pawnBlackCalculator);
+                }
+                return m_positions.size() * 64;
+                });
+
+            // the evaluation of every position after every legal move, full window so none is lazy
+            add("Ai::evaluatePosition (uncached)", [this]() {
+                size_t operations = 0;
+                for (size_t i = 0; i < m_moves.size(); i++)
+                {
+                    for (const auto& board : m_moves[i])
+                        m_sink += m_ai->evaluateClassical(board, !m_sides[i], -INT_MAX, INT_MAX);
+                    operations += m_moves[i].size();
+                }
+                return operations;
+                });
+
+            // the same positions, all of them eval cache hits after the first pass
+            add("Ai::evaluatePosition (cached)", [this]() {
+                size_t operations = 0;
+                for (size_t i = 0; i < m_moves.size(); i++)
+                {
+                    for (const auto& board : m_moves[i])
+                        m_sink += m_ai->evaluatePosition(board, 1, !m_sides[i]);
+                    operations += m_moves[i].size();
+                }
+                return operations;
+                });
+
+            // the legal moves of every position, copied back into the buffer in generation order before sorting
+            add("Ai::sortBoards", [this]() {
+                for (size_t i = 0; i < m_moves.size(); i++)
+                {
+                    m_buffer.assign(m_moves[i].begin(), m_moves[i].end());
+                    m_ai->sortBoards(m_buffer, m_positions[i], m_sides[i], 0);
+                    m_sink += m_buffer.front().getKey();
+                }
+                return m_moves.size();
+                });
+
+            add("Board copy", [this]() {
+                for (size_t i = 0; i < m_positions.size(); i++)
+                    m_copies[i] = m_positions[i];
+                m_sink += m_copies.back().getKey();
+                return m_positions.size();
+                });
+        }
+
+        Result measure(const Benchmark& benchmark)
+        {
+            using Clock = std::chrono::steady_clock;
+
+            // the warm-up also finds how many passes make a run long enough to time
+            size_t passes = 1;
+            for (size_t i = 0; i < m_options.warmupRuns; i++)
+            {
+                auto start = Clock::now();
+                for (size_t pass = 0; pass < passes; pass++)
+                    benchmark.pass();
+                auto elapsed = std::max<Clock::duration>(Clock::now() - start, Clock::duration(1));
+                for (; elapsed < m_options.minRunTime; elapsed *= 2)
+                    passes *= 2;
+            }
+
+            size_t operations = 0;
+            std::vector<double> samples;
+            for (size_t i = 0; i < m_options.runs; i++)
+            {
+                operations = 0;
+                auto start = Clock::now();
+                for (size_t pass = 0; pass < passes; pass++)
+                    operations += benchmark.pass();
+                double nanoseconds = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+                samples.push_back(operations ? nanoseconds / operations : 0.0);
+            }
+            return summarize(benchmark.name, operations, std::move(samples));
+        }
+
+        static void print(const Result& result)
+        {
+            std::cout << std::left << std::setw(36) << result.name << std::right << std::fixed << std::setprecision(2)
+                << " median " << std::setw(10) << result.median << " ns/op"
+                << "  p10 " << std::setw(10) << result.p10
+                << "  p90 " << std::setw(10) << result.p90
+                << "  stddev " << std::setw(8) << result.stddev << "\n";
+            std::cout.unsetf(std::ios::floatfield);
+            std::cout << std::setprecision(6);
+        }
+    };
+}
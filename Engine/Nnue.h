@@ -0,0 +1,221 @@
+#pragma once
+#include <array>
+#include <memory>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "Chess.h"
+
+namespace Chess
+{
+    // Efficiently updatable neural network evaluation. Each side's perspective has 768 inputs, one per
+    // piece type and square, feeding a HIDDEN_SIZE feature transformer whose output (the accumulator)
+    // is updated from the parent position's one with the few pieces a move changed.
+    // The two perspectives, side to move first, go through a clipped ReLU into a single output neuron
+    class Nnue
+    {
+    public:
+        static inline const int INPUT_SIZE = 768;
+        static inline const int HIDDEN_SIZE = 128;
+        static inline const int QA = 255; // feature transformer quantisation, also the clipped ReLU ceiling
+        static inline const int QB = 64;  // output layer quantisation
+        static inline const int OUTPUT_SCALE = 400; // network output to centipawns
+
+        // weights file: this magic, the hidden size as uint32, then the feature weights [INPUT_SIZE][HIDDEN_SIZE],
+        // feature biases [HIDDEN_SIZE] and output weights [2 * HIDDEN_SIZE] as int16 and the output bias as int32
+        static inline const char FILE_MAGIC[8] = { 'C', 'N', 'N', 'U', 'E', '0', '0', '1' };
+
+        struct alignas(32) Accumulator
+        {
+            std::array<int16_t, HIDDEN_SIZE> white;
+            std::array<int16_t, HIDDEN_SIZE> black;
+        };
+
+    private:
+        struct alignas(32) Network
+        {
+            std::array<std::array<int16_t, HIDDEN_SIZE>, INPUT_SIZE> featureWeights;
+            std::array<int16_t, HIDDEN_SIZE> featureBias;
+            std::array<int16_t, 2 * HIDDEN_SIZE> outputWeights;
+            int32_t outputBias;
+        };
+
+        std::shared_ptr<const Network> m_network; // read only once loaded, copies of the Nnue share it
+
+    public:
+        bool isLoaded() const { return m_network != nullptr; };
+
+        bool load(const std::string& path)
+        {
+            std::ifstream file(path, std::ios::binary);
+            if (!file) {
+                std::cout << "Could not open network file " << path << std::endl;
+                return false;
+            }
+
+            char magic[sizeof(FILE_MAGIC)];
+            uint32_t hiddenSize = 0;
+            file.read(magic, sizeof(magic));
+            file.read(reinterpret_cast<char*>(&hiddenSize), sizeof(hiddenSize));
+            if (!file || std::memcmp(magic, FILE_MAGIC, sizeof(FILE_MAGIC)) != 0 || hiddenSize != HIDDEN_SIZE) {
+                std::cout << "Unsupported network file " << path << std::endl;
+                return false;
+            }
+
+            auto network = std::make_shared<Network>();
+            file.read(reinterpret_cast<char*>(network->featureWeights.data()), sizeof(network->featureWeights));
+            file.read(reinterpret_cast<char*>(network->featureBias.data()), sizeof(network->featureBias));
+            file.read(reinterpret_cast<char*>(network->outputWeights.data()), sizeof(network->outputWeights));
+            file.read(reinterpret_cast<char*>(&network->outputBias), sizeof(network->outputBias));
+            if (!file) {
+                std::cout << "Network file " << path << " is truncated" << std::endl;
+                return false;
+            }
+
+            m_network = std::move(network);
+            std::cout << "Network loaded from " << path << std::endl;
+            return true;
+        }
+
+        // full computation from the pieces on the board, used for the root of a search
+        void refresh(Accumulator& accumulator, const Board& board) const
+        {
+            accumulator.white = m_network->featureBias;
+            accumulator.black = m_network->featureBias;
+
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+            {
+                uint64_t mask = board.getBitBoard().getPieceMask(static_cast<PieceTypes>(i));
+                while (mask)
+                {
+                    int square = std::countr_zero(mask);
+                    addWeights(accumulator.white.data(), m_network->featureWeights[featureIndex(i, square, true)].data());
+                    addWeights(accumulator.black.data(), m_network->featureWeights[featureIndex(i, square, false)].data());
+                    mask &= mask - 1;
+                }
+            }
+        }
+
+        // accumulator of a board derived from the one of the board it was generated from
+        void update(const Accumulator& previous, Accumulator& next,
+            const Board& previousBoard, const Board& board) const
+        {
+            next = previous;
+
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+            {
+                uint64_t mask = board.getBitBoard().getPieceMask(static_cast<PieceTypes>(i));
+                uint64_t changed = mask ^ previousBoard.getBitBoard().getPieceMask(static_cast<PieceTypes>(i));
+                while (changed)
+                {
+                    int square = std::countr_zero(changed);
+                    const int16_t* white = m_network->featureWeights[featureIndex(i, square, true)].data();
+                    const int16_t* black = m_network->featureWeights[featureIndex(i, square, false)].data();
+                    if (mask >> square & 1) {
+                        addWeights(next.white.data(), white);
+                        addWeights(next.black.data(), black);
+                    }
+                    else {
+                        subtractWeights(next.white.data(), white);
+                        subtractWeights(next.black.data(), black);
+                    }
+                    changed &= changed - 1;
+                }
+            }
+        }
+
+        // score from the perspective of the side to move
+        int evaluate(const Accumulator& accumulator, bool whiteToMove) const
+        {
+            const int16_t* us = whiteToMove ? accumulator.white.data() : accumulator.black.data();
+            const int16_t* them = whiteToMove ? accumulator.black.data() : accumulator.white.data();
+
+            int64_t output = static_cast<int64_t>(outputDot(us, m_network->outputWeights.data())) +
+                outputDot(them, m_network->outputWeights.data() + HIDDEN_SIZE) +
+                m_network->outputBias;
+            return static_cast<int>(output * OUTPUT_SCALE / (QA * QB));
+        }
+
+    private:
+        // black's perspective sees the board mirrored with the colours swapped,
+        // so both perspectives share the same weights
+        static inline int featureIndex(int type, int square, bool whitePerspective)
+        {
+            int piece = type - 1;
+            if (whitePerspective)
+                return piece * 64 + square;
+            return (piece + 6) % 12 * 64 + (square ^ 56);
+        }
+
+#if defined(__AVX2__)
+        static inline void addWeights(int16_t* accumulator, const int16_t* weights)
+        {
+            for (int i = 0; i < HIDDEN_SIZE; i += 16)
+            {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(accumulator + i));
+                __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(accumulator + i), _mm256_add_epi16(a, w));
+            }
+        }
+
+        static inline void subtractWeights(int16_t* accumulator, const int16_t* weights)
+        {
+            for (int i = 0; i < HIDDEN_SIZE; i += 16)
+            {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(accumulator + i));
+                __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(accumulator + i), _mm256_sub_epi16(a, w));
+            }
+        }
+
+        // clipped ReLU of the accumulator dotted with the output weights,
+        // madd multiplies the int16 pairs and sums them into int32 lanes
+        static inline int32_t outputDot(const int16_t* accumulator, const int16_t* weights)
+        {
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i ceiling = _mm256_set1_epi16(QA);
+            __m256i sum = _mm256_setzero_si256();
+            for (int i = 0; i < HIDDEN_SIZE; i += 16)
+            {
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(accumulator + i));
+                __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(weights + i));
+                a = _mm256_min_epi16(_mm256_max_epi16(a, zero), ceiling);
+                sum = _mm256_add_epi32(sum, _mm256_madd_epi16(a, w));
+            }
+
+            __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+            half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(1, 0, 3, 2)));
+            half = _mm_add_epi32(half, _mm_shuffle_epi32(half, _MM_SHUFFLE(2, 3, 0, 1)));
+            return _mm_cvtsi128_si32(half);
+        }
+#else
+        static inline void addWeights(int16_t* accumulator, const int16_t* weights)
+        {
+            for (int i = 0; i < HIDDEN_SIZE; i++)
+                accumulator[i] += weights[i];
+        }
+
+        static inline void subtractWeights(int16_t* accumulator, const int16_t* weights)
+        {
+            for (int i = 0; i < HIDDEN_SIZE; i++)
+                accumulator[i] -= weights[i];
+        }
+
+        static inline int32_t outputDot(const int16_t* accumulator, const int16_t* weights)
+        {
+            int32_t sum = 0;
+            for (int i = 0; i < HIDDEN_SIZE; i++)
+                sum += std::clamp<int32_t>(accumulator[i], 0, QA) * weights[i];
+            return sum;
+        }
+#endif
+    };
+}
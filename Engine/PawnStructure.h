@@ -0,0 +1,199 @@
+#pragma once
+#include <array>
+#include <vector>
+#include <bit>
+
+#include "Chess.h"
+
+namespace Chess
+{
+    // Pawn structure terms computed with bitboard fills, all scores from white's perspective
+    class PawnStructure
+    {
+    public:
+        static inline uint64_t northFill(uint64_t mask)
+        {
+            mask |= mask << 8;
+            mask |= mask << 16;
+            mask |= mask << 32;
+            return mask;
+        }
+
+        static inline uint64_t southFill(uint64_t mask)
+        {
+            mask |= mask >> 8;
+            mask |= mask >> 16;
+            mask |= mask >> 32;
+            return mask;
+        }
+
+        static inline uint64_t fileFill(uint64_t mask)
+        {
+            return northFill(mask) | southFill(mask);
+        }
+
+        static inline uint64_t eastOne(uint64_t mask)
+        {
+            return (mask & ~FILE_H) << 1;
+        }
+
+        static inline uint64_t westOne(uint64_t mask)
+        {
+            return (mask & ~FILE_A) >> 1;
+        }
+
+        static inline uint64_t adjacentFiles(uint64_t mask)
+        {
+            return eastOne(mask) | westOne(mask);
+        }
+
+        // squares in front of the pawns on their own file, not including the pawns
+        static inline uint64_t whiteFrontSpans(uint64_t whitePawns)
+        {
+            return northFill(whitePawns) << 8;
+        }
+
+        static inline uint64_t blackFrontSpans(uint64_t blackPawns)
+        {
+            return southFill(blackPawns) >> 8;
+        }
+
+        static inline uint64_t whitePawnAttacks(uint64_t whitePawns)
+        {
+            return adjacentFiles(whitePawns) << 8;
+        }
+
+        static inline uint64_t blackPawnAttacks(uint64_t blackPawns)
+        {
+            return adjacentFiles(blackPawns) >> 8;
+        }
+
+        static inline uint64_t whitePassedPawns(uint64_t whitePawns, uint64_t blackPawns)
+        {
+            uint64_t blackSpans = blackFrontSpans(blackPawns);
+            return whitePawns & ~(blackSpans | adjacentFiles(blackSpans)) & ~southFill(whitePawns >> 8);
+        }
+
+        static inline uint64_t blackPassedPawns(uint64_t blackPawns, uint64_t whitePawns)
+        {
+            uint64_t whiteSpans = whiteFrontSpans(whitePawns);
+            return blackPawns & ~(whiteSpans | adjacentFiles(whiteSpans)) & ~northFill(blackPawns << 8);
+        }
+
+        static inline uint64_t isolatedPawns(uint64_t pawns)
+        {
+            return pawns & ~adjacentFiles(fileFill(pawns));
+        }
+
+        // pawns with a friendly pawn in front of them on the same file, counted once per extra pawn
+        static inline uint64_t whiteDoubledPawns(uint64_t whitePawns)
+        {
+            return whitePawns & southFill(whitePawns >> 8);
+        }
+
+        static inline uint64_t blackDoubledPawns(uint64_t blackPawns)
+        {
+            return blackPawns & northFill(blackPawns << 8);
+        }
+
+        // pawns whose stop square is attacked by an enemy pawn and can't be covered by a friendly one
+        static inline uint64_t whiteBackwardPawns(uint64_t whitePawns, uint64_t blackPawns)
+        {
+            uint64_t attackSpans = northFill(whitePawnAttacks(whitePawns));
+            uint64_t stops = whitePawns << 8;
+            return (stops & blackPawnAttacks(blackPawns) & ~attackSpans) >> 8;
+        }
+
+        static inline uint64_t blackBackwardPawns(uint64_t blackPawns, uint64_t whitePawns)
+        {
+            uint64_t attackSpans = southFill(blackPawnAttacks(blackPawns));
+            uint64_t stops = blackPawns >> 8;
+            return (stops & whitePawnAttacks(whitePawns) & ~attackSpans) << 8;
+        }
+
+        static Score evaluate(uint64_t whitePawns, uint64_t blackPawns)
+        {
+            const EvalParameters& parameters = evalParameters();
+            Score score = 0;
+
+            uint64_t passed = whitePassedPawns(whitePawns, blackPawns);
+            while (passed) {
+                score += parameters.passedPawnBonus[std::countr_zero(passed) / 8];
+                passed &= passed - 1;
+            }
+
+            passed = blackPassedPawns(blackPawns, whitePawns);
+            while (passed) {
+                score -= parameters.passedPawnBonus[7 - std::countr_zero(passed) / 8];
+                passed &= passed - 1;
+            }
+
+            score += parameters.isolatedPawnPenalty *
+                (std::popcount(isolatedPawns(whitePawns)) - std::popcount(isolatedPawns(blackPawns)));
+            score += parameters.doubledPawnPenalty *
+                (std::popcount(whiteDoubledPawns(whitePawns)) - std::popcount(blackDoubledPawns(blackPawns)));
+            score += parameters.backwardPawnPenalty *
+                (std::popcount(whiteBackwardPawns(whitePawns, blackPawns)) -
+                    std::popcount(blackBackwardPawns(blackPawns, whitePawns)));
+
+            return score;
+        }
+    };
+
+    // Caches pawn structure scores by the board's pawn key, one table per search thread so no locking is needed
+    class PawnHashTable
+    {
+    public:
+        static inline const size_t DEFAULT_SIZE = 1 << 14; //entries, must be a power of two
+
+        struct Entry
+        {
+            uint64_t key = 0;
+            Score score = 0;
+            bool valid = false;
+        };
+
+    private:
+        std::vector<Entry> m_entries;
+        size_t m_mask;
+        size_t m_probes = 0;
+        size_t m_hits = 0;
+
+    public:
+        PawnHashTable(size_t size = DEFAULT_SIZE) : m_entries(size), m_mask(size - 1) {};
+
+        Score probe(const Board& board)
+        {
+            uint64_t key = board.getPawnKey();
+            Entry& entry = m_entries[key & m_mask];
+            m_probes++;
+
+            if (entry.valid && entry.key == key) {
+                m_hits++;
+                return entry.score;
+            }
+
+            entry.key = key;
+            entry.score = PawnStructure::evaluate(
+                board.getBitBoard().getPieceMask(PieceTypes::WHITE_PAWN),
+                board.getBitBoard().getPieceMask(PieceTypes::BLACK_PAWN));
+            entry.valid = true;
+            return entry.score;
+        }
+
+        size_t getProbes() const { return m_probes; };
+        size_t getHits() const { return m_hits; };
+
+        void resetStatistics()
+        {
+            m_probes = 0;
+            m_hits = 0;
+        }
+
+        void clear()
+        {
+            std::fill(m_entries.begin(), m_entries.end(), Entry());
+            resetStatistics();
+        }
+    };
+}
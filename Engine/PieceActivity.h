@@ -0,0 +1,172 @@
+#pragma once
+#include <array>
+#include <bit>
+
+#include "Chess.h"
+#include "PawnStructure.h"
+
+namespace Chess
+{
+    // Attack bitboards of every piece on the board, built once per evaluation and shared by the terms using them
+    struct AttackMaps
+    {
+        struct PieceAttacks
+        {
+            PieceTypes type;
+            uint64_t attacks;
+        };
+
+        std::array<PieceAttacks, 32> pieces; // every piece except pawns and kings
+        size_t pieceCount = 0;
+        std::array<uint64_t, static_cast<size_t>(PieceTypes::NUM)> byType = { 0 }; // union of the attacks of each piece type
+
+        static inline bool isWhite(PieceTypes type)
+        {
+            return type <= PieceTypes::WHITE_KING;
+        }
+
+        void build(const Board& board)
+        {
+            const Board::BitBoard& bitBoard = board.getBitBoard();
+            uint64_t occupancy = bitBoard.getAllPieces();
+
+            pieceCount = 0;
+            byType.fill(0);
+
+            for (int i = 1; i < static_cast<int>(PieceTypes::NUM); i++)
+            {
+                PieceTypes type = static_cast<PieceTypes>(i);
+                uint64_t mask = bitBoard.getPieceMask(type);
+
+                switch (type)
+                {
+                case PieceTypes::WHITE_PAWN:
+                    byType[i] = PawnStructure::whitePawnAttacks(mask);
+                    continue;
+                case PieceTypes::BLACK_PAWN:
+                    byType[i] = PawnStructure::blackPawnAttacks(mask);
+                    continue;
+                case PieceTypes::WHITE_KING:
+                case PieceTypes::BLACK_KING:
+                    byType[i] = mask ? KING_ATTACKS[std::countr_zero(mask)] & ~mask : 0;
+                    continue;
+                default:
+                    break;
+                }
+
+                while (mask) {
+                    int square = std::countr_zero(mask);
+                    uint64_t attacks = pieceAttacks(type, square, occupancy);
+                    byType[i] |= attacks;
+                    if (pieceCount < pieces.size())
+                        pieces[pieceCount++] = { type, attacks };
+                    mask &= mask - 1;
+                }
+            }
+        }
+
+        static inline uint64_t pieceAttacks(PieceTypes type, int square, uint64_t occupancy)
+        {
+            switch (type)
+            {
+            case PieceTypes::WHITE_KNIGHT:
+            case PieceTypes::BLACK_KNIGHT:
+                return KNIGHT_ATTACKS[square];
+            case PieceTypes::WHITE_BISHOP:
+            case PieceTypes::BLACK_BISHOP:
+                return MagicBishops::getAttacks(square, occupancy);
+            case PieceTypes::WHITE_ROOK:
+            case PieceTypes::BLACK_ROOK:
+                return MagicRooks::getAttacks(square, occupancy);
+            default: //queens
+                return MagicBishops::getAttacks(square, occupancy) | MagicRooks::getAttacks(square, occupancy);
+            }
+        }
+    };
+
+    // Mobility and king safety, scores from white's perspective
+    class PieceActivity
+    {
+    public:
+        static Score evaluate(const Board& board, const AttackMaps& maps)
+        {
+            return mobility(board, maps) + kingSafety(board, maps);
+        }
+
+        static Score mobility(const Board& board, const AttackMaps& maps)
+        {
+            const Board::BitBoard& bitBoard = board.getBitBoard();
+            // squares occupied by own pieces or covered by enemy pawns don't count
+            uint64_t whiteArea = ~bitBoard.getAllWhitePieces() & ~maps.byType[static_cast<size_t>(PieceTypes::BLACK_PAWN)];
+            uint64_t blackArea = ~bitBoard.getAllBlackPieces() & ~maps.byType[static_cast<size_t>(PieceTypes::WHITE_PAWN)];
+
+            const EvalParameters& parameters = evalParameters();
+            Score score = 0;
+            for (size_t i = 0; i < maps.pieceCount; i++)
+            {
+                const auto& piece = maps.pieces[i];
+                int kind = EvalParameters::pieceKind(piece.type);
+                if (AttackMaps::isWhite(piece.type))
+                    score += parameters.mobilityWeights[kind] *
+                        (std::popcount(piece.attacks & whiteArea) - parameters.mobilityBaseline[kind]);
+                else score -= parameters.mobilityWeights[kind] *
+                    (std::popcount(piece.attacks & blackArea) - parameters.mobilityBaseline[kind]);
+            }
+            return score;
+        }
+
+        static Score kingSafety(const Board& board, const AttackMaps& maps)
+        {
+            const Board::BitBoard& bitBoard = board.getBitBoard();
+            uint64_t whiteKing = bitBoard.getPieceMask(PieceTypes::WHITE_KING);
+            uint64_t blackKing = bitBoard.getPieceMask(PieceTypes::BLACK_KING);
+            if (!whiteKing || !blackKing)
+                return 0;
+
+            uint64_t whiteZone = KING_ATTACKS[std::countr_zero(whiteKing)] | whiteKing;
+            uint64_t blackZone = KING_ATTACKS[std::countr_zero(blackKing)] | blackKing;
+
+            const EvalParameters& parameters = evalParameters();
+            int whiteUnits = 0, blackUnits = 0; // attack units against each king
+            int whiteAttackers = 0, blackAttackers = 0;
+            for (size_t i = 0; i < maps.pieceCount; i++)
+            {
+                const auto& piece = maps.pieces[i];
+                int kind = EvalParameters::pieceKind(piece.type);
+                if (AttackMaps::isWhite(piece.type)) {
+                    if (uint64_t hits = piece.attacks & blackZone) {
+                        blackUnits += parameters.kingAttackUnits[kind] * std::popcount(hits);
+                        blackAttackers++;
+                    }
+                }
+                else if (uint64_t hits = piece.attacks & whiteZone) {
+                    whiteUnits += parameters.kingAttackUnits[kind] * std::popcount(hits);
+                    whiteAttackers++;
+                }
+            }
+
+            Score score = 0;
+            // a single attacker is rarely dangerous
+            if (whiteAttackers >= 2)
+                score -= kingDanger(whiteUnits);
+            if (blackAttackers >= 2)
+                score += kingDanger(blackUnits);
+
+            // own pawns on the king's and the adjacent files, one or two ranks in front of it
+            uint64_t whiteFiles = whiteKing | PawnStructure::adjacentFiles(whiteKing);
+            uint64_t blackFiles = blackKing | PawnStructure::adjacentFiles(blackKing);
+            uint64_t whiteShield = (whiteFiles << 8 | whiteFiles << 16) & bitBoard.getPieceMask(PieceTypes::WHITE_PAWN);
+            uint64_t blackShield = (blackFiles >> 8 | blackFiles >> 16) & bitBoard.getPieceMask(PieceTypes::BLACK_PAWN);
+            score += parameters.pawnShieldBonus * (std::popcount(whiteShield) - std::popcount(blackShield));
+
+            return score;
+        }
+
+        // grows quadratically, a few attackers together are worth far more than the sum of them alone
+        static inline Score kingDanger(int units)
+        {
+            units = std::min(units, evalParameters().maxKingAttackUnits);
+            return makeScore(units * units / 4, 0);
+        }
+    };
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <vector>
+#include <array>
+#include <span>
+
+#include "Chess.h"
+
+namespace Chess
+{
+    // Per ply state of a search, allocated once by the searching thread's Ai before its first search.
+    // Every ply owns a move buffer with room for any position, nodes clear and refill the buffer of their
+    // ply instead of allocating their own, so the search itself never touches the heap
+    class SearchStack
+    {
+    public:
+        static inline const size_t MAX_MOVES = 256; // the most legal moves of any position is 218
+        static inline const int KILLER_COUNT = 2;
+
+        struct Frame
+        {
+            std::vector<Board> moves; // the boards after every legal move of the node at this ply
+            std::array<Board::Move, KILLER_COUNT> killers; // quiet moves that caused a beta cutoff at this ply, newest first
+            const Board* board = nullptr; // board searched at this ply, the next ply's is diffed against it
+
+            // principal variation from this ply on, the first pvLength moves are valid
+            std::vector<Board::Move> pv;
+            size_t pvLength = 0;
+        };
+
+    private:
+        std::vector<Frame> m_frames;
+
+    public:
+        bool isAllocated() const { return !m_frames.empty(); };
+
+        void allocate(size_t plies)
+        {
+            m_frames.resize(plies);
+            for (auto& frame : m_frames)
+            {
+                frame.moves.reserve(MAX_MOVES);
+                frame.pv.resize(plies);
+            }
+        }
+
+        Frame& operator[](int ply) { return m_frames[ply]; };
+        const Frame& operator[](int ply) const { return m_frames[ply]; };
+
+        // killers are only valid for the search that found them
+        void clearKillers()
+        {
+            for (auto& frame : m_frames)
+                frame.killers.fill(Board::Move());
+        }
+
+        void storeKiller(int ply, const Board::Move& move)
+        {
+            auto& killers = m_frames[ply].killers;
+            if (killers[0] == move)
+                return;
+            for (int i = KILLER_COUNT - 1; i > 0; i--)
+                killers[i] = killers[i - 1];
+            killers[0] = move;
+        }
+
+        // the killer slot holding the move, -1 if the move isn't a killer at the ply
+        int killerIndex(int ply, const Board::Move& move) const
+        {
+            const auto& killers = m_frames[ply].killers;
+            for (int i = 0; i < KILLER_COUNT; i++)
+                if (killers[i] == move)
+                    return i;
+            return -1;
+        }
+
+        void clearPv(int ply)
+        {
+            m_frames[ply].pvLength = 0;
+        }
+
+        // the move became the best one of the ply, its line continues with the next ply's principal variation
+        void updatePv(int ply, const Board::Move& move)
+        {
+            Frame& frame = m_frames[ply];
+            frame.pv[0] = move;
+            frame.pvLength = 1;
+            if (static_cast<size_t>(ply) + 1 < m_frames.size())
+            {
+                const Frame& next = m_frames[ply + 1];
+                std::copy(next.pv.begin(), next.pv.begin() + next.pvLength, frame.pv.begin() + 1);
+                frame.pvLength += next.pvLength;
+            }
+        }
+
+        std::span<const Board::Move> getPv(int ply = 0) const
+        {
+            return { m_frames[ply].pv.data(), m_frames[ply].pvLength };
+        }
+    };
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace Chess
+{
+    // Bounded lock free queue between exactly one producer thread and one consumer thread.
+    // Each side only writes its own index, the other side's index tells it how far it may go.
+    // Capacity has to be a power of two, one slot stays empty to tell a full queue from an empty one
+    template<typename T, size_t Capacity>
+    class SpscQueue
+    {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    private:
+        std::array<T, Capacity> m_slots;
+        alignas(64) std::atomic<size_t> m_head{ 0 }; // next slot to pop, written by the consumer
+        alignas(64) std::atomic<size_t> m_tail{ 0 }; // next slot to push, written by the producer
+
+    public:
+        // producer only, fails without blocking when the consumer fell behind
+        bool tryPush(const T& value)
+        {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            size_t next = (tail + 1) & (Capacity - 1);
+            if (next == m_head.load(std::memory_order_acquire))
+                return false;
+
+            m_slots[tail] = value;
+            m_tail.store(next, std::memory_order_release);
+            return true;
+        }
+
+        // consumer only
+        bool tryPop(T& value)
+        {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_tail.load(std::memory_order_acquire))
+                return false;
+
+            value = m_slots[head];
+            m_head.store((head + 1) & (Capacity - 1), std::memory_order_release);
+            return true;
+        }
+
+        // consumer only, discards everything pushed so far
+        void clear()
+        {
+            m_head.store(m_tail.load(std::memory_order_acquire), std::memory_order_release);
+        }
+    };
+}
@@ -0,0 +1,332 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <cmath>
+#include <chrono>
+
+#include "Ai.h"
+#include "Multithreading/ThreadPool.h"
+
+namespace Chess
+{
+    // Texel tuning of the piece values and piece-square tables against game results.
+    // The material and piece-square part of the evaluation is linear in the tuned parameters,
+    // so every position is stored as its pieces, its phase and the rest of the real evaluation
+    // (pawn structure, mobility, king safety) as a fixed offset. The logistic loss is minimised
+    // with Adam, a gradient descent variant, the gradient is computed in chunks over the thread pool
+    class TexelTuner
+    {
+    public:
+        static inline const int TUNED_PIECE_TYPES = 6; // white pawn to king, black uses the mirrored values
+        static inline const double DEFAULT_LEARNING_RATE = 1.0;
+
+    private:
+        // parameter layout: piece values (king excluded), midgame tables, endgame tables
+        static inline const int VALUES_OFFSET = 0;
+        static inline const int MIDGAME_TABLES_OFFSET = VALUES_OFFSET + TUNED_PIECE_TYPES - 1;
+        static inline const int ENDGAME_TABLES_OFFSET = MIDGAME_TABLES_OFFSET + TUNED_PIECE_TYPES * 64;
+        static inline const int PARAMETER_COUNT = ENDGAME_TABLES_OFFSET + TUNED_PIECE_TYPES * 64;
+
+        struct Piece
+        {
+            uint8_t type;   // 1 to 6, white's piece types
+            uint8_t square; // from the piece owner's side, black's squares are mirrored
+            int8_t sign;    // +1 for white, -1 for black
+        };
+
+        struct Position
+        {
+            uint32_t firstPiece; // into m_pieces
+            uint8_t pieceCount;
+            uint8_t phase;
+            float offset;   // evaluation not covered by the tuned parameters
+            float result;   // 1 white won, 0.5 draw, 0 black won
+        };
+
+        std::vector<Position> m_positions;
+        std::vector<Piece> m_pieces;
+        std::vector<double> m_parameters;
+        MT::ThreadPool& m_pool;
+        double m_k = 1.0; // sigmoid scaling, fitted to the dataset before tuning
+
+    public:
+        // starts from the evaluation's current parameters
+        TexelTuner(MT::ThreadPool& pool) : m_pool(pool)
+        {
+            const EvalParameters& parameters = evalParameters();
+            m_parameters.assign(PARAMETER_COUNT, 0.0);
+            for (int type = 1; type <= TUNED_PIECE_TYPES; type++)
+            {
+                if (type < TUNED_PIECE_TYPES)
+                    m_parameters[VALUES_OFFSET + type - 1] = parameters.pieceValues[type - 1];
+                for (int square = 0; square < 64; square++)
+                {
+                    m_parameters[MIDGAME_TABLES_OFFSET + (type - 1) * 64 + square] = parameters.midgameTables[type - 1][square];
+                    m_parameters[ENDGAME_TABLES_OFFSET + (type - 1) * 64 + square] = parameters.endgameTables[type - 1][square];
+                }
+            }
+        }
+
+        // one position per line, a fen followed by the result as 1-0, 0-1, 1/2-1/2 or 1.0, 0.5, 0.0,
+        // optionally quoted or bracketed. Known endgames are skipped, their evaluation isn't linear
+        size_t loadDataset(const std::string& path)
+        {
+            std::ifstream file(path);
+            if (!file) {
+                std::cout << "Could not open dataset " << path << std::endl;
+                return 0;
+            }
+
+            std::vector<Board> boards;
+            std::vector<float> results;
+            std::string line;
+            size_t skipped = 0;
+            while (std::getline(file, line))
+            {
+                size_t split = line.find_last_of(" \t");
+                if (split == std::string::npos)
+                    continue;
+
+                float result;
+                bool whiteToMove;
+                auto board = Board::fromFen(line.substr(0, split), whiteToMove);
+                if (!board || !parseResult(line.substr(split + 1), result) ||
+                    Endgames::probe(board->getMaterialKey())) {
+                    skipped++;
+                    continue;
+                }
+                boards.push_back(*board);
+                results.push_back(result);
+            }
+
+            // the real evaluation of every position, each chunk with its own ai for the pawn hash table
+            std::vector<int> scores(boards.size());
+            forEachChunk(boards.size(), [&boards, &scores](size_t, size_t begin, size_t end) {
+                auto ai = std::make_unique<Ai>();
+                ai->evaluateBatch(std::span<const Board>(boards).subspan(begin, end - begin),
+                    std::span<int>(scores).subspan(begin, end - begin));
+                });
+
+            m_positions.reserve(m_positions.size() + boards.size());
+            for (size_t i = 0; i < boards.size(); i++)
+            {
+                Position position;
+                position.firstPiece = static_cast<uint32_t>(m_pieces.size());
+                position.phase = static_cast<uint8_t>(std::min(boards[i].getPhase(), MAX_GAME_PHASE));
+                position.result = results[i];
+
+                for (int type = 1; type < static_cast<int>(PieceTypes::NUM); type++)
+                {
+                    uint64_t mask = boards[i].getBitBoard().getPieceMask(static_cast<PieceTypes>(type));
+                    bool white = type <= TUNED_PIECE_TYPES;
+                    while (mask)
+                    {
+                        int square = std::countr_zero(mask);
+                        m_pieces.push_back({
+                            static_cast<uint8_t>(white ? type : type - TUNED_PIECE_TYPES),
+                            static_cast<uint8_t>(white ? square : square ^ 56),
+                            static_cast<int8_t>(white ? 1 : -1) });
+                        mask &= mask - 1;
+                    }
+                }
+                position.pieceCount = static_cast<uint8_t>(m_pieces.size() - position.firstPiece);
+                position.offset = static_cast<float>(scores[i] - linearEvaluation(position));
+                m_positions.push_back(position);
+            }
+
+            std::cout << "Loaded " << boards.size() << " positions, skipped " << skipped << std::endl;
+            return boards.size();
+        }
+
+        // scaling of the sigmoid that best maps the current evaluation to the results
+        double fitK()
+        {
+            double low = 0.1, high = 3.0;
+            for (int i = 0; i < 40; i++)
+            {
+                double first = low + (high - low) / 3, second = high - (high - low) / 3;
+                m_k = first;
+                double firstLoss = computeLoss();
+                m_k = second;
+                if (firstLoss < computeLoss())
+                    high = second;
+                else low = first;
+            }
+            m_k = (low + high) / 2;
+            return m_k;
+        }
+
+        double computeLoss()
+        {
+            std::vector<double> losses(chunkCount(), 0.0);
+            forEachChunk(m_positions.size(), [this, &losses](size_t chunk, size_t begin, size_t end) {
+                double loss = 0.0;
+                for (size_t i = begin; i < end; i++)
+                {
+                    double error = m_positions[i].result - sigmoid(evaluate(m_positions[i]));
+                    loss += error * error;
+                }
+                losses[chunk] = loss;
+                });
+
+            double loss = 0.0;
+            for (double chunkLoss : losses)
+                loss += chunkLoss;
+            return m_positions.empty() ? 0.0 : loss / m_positions.size();
+        }
+
+        // runs the epochs, reporting the loss and the throughput of each
+        void tune(int epochs, double learningRate = DEFAULT_LEARNING_RATE)
+        {
+            const double beta1 = 0.9, beta2 = 0.999, epsilon = 1e-8;
+            std::vector<double> momentum(PARAMETER_COUNT, 0.0), velocity(PARAMETER_COUNT, 0.0);
+
+            std::cout << "K: " << fitK() << ", initial loss: " << computeLoss() << std::endl;
+            for (int epoch = 1; epoch <= epochs; epoch++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                std::vector<double> gradient = computeGradient();
+
+                for (int i = 0; i < PARAMETER_COUNT; i++)
+                {
+                    momentum[i] = beta1 * momentum[i] + (1 - beta1) * gradient[i];
+                    velocity[i] = beta2 * velocity[i] + (1 - beta2) * gradient[i] * gradient[i];
+                    double correctedMomentum = momentum[i] / (1 - std::pow(beta1, epoch));
+                    double correctedVelocity = velocity[i] / (1 - std::pow(beta2, epoch));
+                    m_parameters[i] -= learningRate * correctedMomentum / (std::sqrt(correctedVelocity) + epsilon);
+                }
+
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+                std::cout << "Epoch " << epoch << ": loss " << computeLoss() << ", "
+                    << (seconds > 0 ? m_positions.size() / seconds : 0.0) << " positions/s" << std::endl;
+            }
+        }
+
+        // writes the evaluation's parameters with the tuned ones replaced, in the format EvalParameters::load reads
+        bool writeParameters(const std::string& path) const
+        {
+            EvalParameters parameters = evalParameters();
+            for (int type = 1; type <= TUNED_PIECE_TYPES; type++)
+            {
+                if (type < TUNED_PIECE_TYPES)
+                    parameters.pieceValues[type - 1] = std::lround(m_parameters[VALUES_OFFSET + type - 1]);
+                for (int square = 0; square < 64; square++)
+                {
+                    parameters.midgameTables[type - 1][square] =
+                        std::lround(m_parameters[MIDGAME_TABLES_OFFSET + (type - 1) * 64 + square]);
+                    parameters.endgameTables[type - 1][square] =
+                        std::lround(m_parameters[ENDGAME_TABLES_OFFSET + (type - 1) * 64 + square]);
+                }
+            }
+
+            if (!parameters.save(path))
+                return false;
+            std::cout << "Parameters written to " << path << std::endl;
+            return true;
+        }
+
+        size_t getPositionCount() const { return m_positions.size(); };
+
+    private:
+        static bool parseResult(std::string token, float& result)
+        {
+            std::erase_if(token, [](char c) { return c == '"' || c == '[' || c == ']' || c == ';'; });
+            if (token == "1-0" || token == "1.0" || token == "1")
+                result = 1.0f;
+            else if (token == "0-1" || token == "0.0" || token == "0")
+                result = 0.0f;
+            else if (token == "1/2-1/2" || token == "0.5")
+                result = 0.5f;
+            else return false;
+            return true;
+        }
+
+        // a few chunks per worker so uneven chunks don't leave workers idle
+        size_t chunkCount()
+        {
+            return m_pool.getWorkerAmount() * 4 + 1;
+        }
+
+        // splits the range into chunkCount() chunks processed by the pool, waits for all of them.
+        // the function gets the chunk's index and range, so results can go into per chunk slots
+        template<typename Function>
+        void forEachChunk(size_t size, Function&& function)
+        {
+            size_t chunks = chunkCount();
+            size_t chunkSize = std::max<size_t>((size + chunks - 1) / chunks, 1);
+            std::vector<std::function<void()>> tasks;
+            for (size_t begin = 0, chunk = 0; begin < size; begin += chunkSize, chunk++)
+            {
+                size_t end = std::min(size, begin + chunkSize);
+                tasks.push_back([&function, chunk, begin, end]() { function(chunk, begin, end); });
+            }
+            m_pool.pushTasks(std::move(tasks));
+            m_pool.waitForAll();
+        }
+
+        inline double sigmoid(double score) const
+        {
+            return 1.0 / (1.0 + std::pow(10.0, -m_k * score / 400.0));
+        }
+
+        // material and piece-square part of the evaluation with the current parameters, from white's perspective
+        double linearEvaluation(const Position& position) const
+        {
+            double midgameWeight = position.phase / static_cast<double>(MAX_GAME_PHASE);
+            double score = 0.0;
+            for (uint32_t i = position.firstPiece; i < position.firstPiece + position.pieceCount; i++)
+            {
+                const Piece& piece = m_pieces[i];
+                double value = piece.type < TUNED_PIECE_TYPES ? m_parameters[VALUES_OFFSET + piece.type - 1] : 0.0;
+                double midgame = m_parameters[MIDGAME_TABLES_OFFSET + (piece.type - 1) * 64 + piece.square];
+                double endgame = m_parameters[ENDGAME_TABLES_OFFSET + (piece.type - 1) * 64 + piece.square];
+                value += midgame * midgameWeight + endgame * (1.0 - midgameWeight);
+                score += piece.sign * value;
+            }
+            return score;
+        }
+
+        inline double evaluate(const Position& position) const
+        {
+            return position.offset + linearEvaluation(position);
+        }
+
+        // gradient of the mean squared error between the results and the sigmoid of the evaluation
+        std::vector<double> computeGradient()
+        {
+            std::vector<std::vector<double>> partials(chunkCount(), std::vector<double>(PARAMETER_COUNT, 0.0));
+
+            forEachChunk(m_positions.size(), [this, &partials](size_t chunk, size_t begin, size_t end) {
+                std::vector<double>& gradient = partials[chunk];
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Position& position = m_positions[i];
+                    double s = sigmoid(evaluate(position));
+                    // d(result - s)^2 / d score
+                    double slope = -2.0 * (position.result - s) * s * (1.0 - s) * m_k * std::log(10.0) / 400.0;
+                    double midgameWeight = position.phase / static_cast<double>(MAX_GAME_PHASE);
+
+                    for (uint32_t j = position.firstPiece; j < position.firstPiece + position.pieceCount; j++)
+                    {
+                        const Piece& piece = m_pieces[j];
+                        double signedSlope = slope * piece.sign;
+                        if (piece.type < TUNED_PIECE_TYPES)
+                            gradient[VALUES_OFFSET + piece.type - 1] += signedSlope;
+                        gradient[MIDGAME_TABLES_OFFSET + (piece.type - 1) * 64 + piece.square] += signedSlope * midgameWeight;
+                        gradient[ENDGAME_TABLES_OFFSET + (piece.type - 1) * 64 + piece.square] +=
+                            signedSlope * (1.0 - midgameWeight);
+                    }
+                }
+                });
+
+            std::vector<double> gradient(PARAMETER_COUNT, 0.0);
+            for (const auto& partial : partials)
+                for (int i = 0; i < PARAMETER_COUNT; i++)
+                    gradient[i] += partial[i] / std::max<size_t>(m_positions.size(), 1);
+            return gradient;
+        }
+    };
+}
@@ -163,7 +163,7 @@ void Game::processInputs()
         auto access = m_board.getWriteAccess();
         if (access->revertDouble() && access->playerIsWhite() != access->currentPlayerIsWhite() && access->shouldContinue())
         {
-            m_ai.getBestMoveAsync(access->getBoard(), m_threadPool,
+            m_ai.getBestMoveAsync(access->getBoard(), access->getKeyHistory(), m_threadPool,
                 [this](Chess::Board nextBoard) {asyncMoveCallback(nextBoard); });
         }
     }
@@ -174,7 +174,7 @@ void Game::processInputs()
             access->playerIsWhite() == access->currentPlayerIsWhite() &&
             access->onLMBPress(m_mouse) && access->shouldContinue())
         {
-            m_ai.getBestMoveAsync(access->getBoard(), m_threadPool,
+            m_ai.getBestMoveAsync(access->getBoard(), access->getKeyHistory(), m_threadPool,
                 [this](Chess::Board nextBoard) {asyncMoveCallback(nextBoard); });
         }
     }
@@ -339,10 +339,14 @@ int Game::run()
         }
         else
         {
+            // a search's callback takes the board, so it is released while waiting for the searches
+            if (!m_board.getWriteAccess()->shouldContinue())
+                m_ai.abortAndWait();
+
             auto access = m_board.getWriteAccess();
             if (!access->shouldContinue())
             {
-                m_ai.abortAndWait();
+                m_gameDrawn = access->isDraw();
                 if (access->getBoard().isBlackChecked() == access->playerIsWhite())
                     m_playerWon = true;
                 else m_playerWon = false;
@@ -365,6 +369,7 @@ int Game::run()
             m_renderer.remeshScene(*access, m_width, m_height);
             m_renderer.setHighlight(*access, m_mouse, m_width, m_height);
             m_renderer.draw(*access, m_mouse, m_window, m_width, m_height, m_frameTime);
+            renderSearchInfo();
         }
 
         ImGui::Render();
@@ -373,6 +378,8 @@ int Game::run()
 
     }
 
+    // a ponder search would otherwise keep the pool busy until it reaches its full depth
+    m_ai.abortAndWait();
     m_threadPool.shutdown();
     return 0;
 }
\ No newline at end of file
@@ -58,6 +58,8 @@ private:
     size_t m_aiDepth = 4;
     bool m_vsAi = false;
     bool m_playerWon = false;
+    bool m_gameDrawn = false;
+    Chess::Ai::SearchInfo m_searchInfo; // latest progress of the AI's search, drained every frame
 
 	float m_frameTime, m_runtime;
 	float m_aspectRatio;
@@ -100,7 +102,12 @@ public:
 	int run();
 
     void asyncMoveCallback(const Chess::Board& move) {
-        m_board.getWriteAccess()->makeMove(move);
+        auto access = m_board.getWriteAccess();
+        access->makeMove(move);
+
+        // think about the reply the search expects while the player thinks about theirs
+        if (access->shouldContinue())
+            m_ai.startPondering(access->getBoard(), access->getKeyHistory(), m_threadPool);
     }
 
 	void renderMenus() {
@@ -215,6 +222,7 @@ public:
         if (ImGui::Button("Play as White", ImVec2(buttonWidth, buttonHeight))) {
             //startGame(true);
             m_board.getWriteAccess()->startNewGame(true);
+            m_searchInfo = Chess::Ai::SearchInfo();
             m_ai.reset(false, m_aiDepth);
             m_gameState = State::PLAYING;
         }
@@ -222,10 +230,11 @@ public:
         if (ImGui::Button("Play as Black", ImVec2(buttonWidth, buttonHeight))) {
             auto access = m_board.getWriteAccess();
             access->startNewGame(false);
+            m_searchInfo = Chess::Ai::SearchInfo();
             m_ai.reset(true, m_aiDepth);
 
             // If player is black, AI should make first move
-            m_ai.getBestMoveAsync(access->getBoard(), m_threadPool,
+            m_ai.getBestMoveAsync(access->getBoard(), access->getKeyHistory(), m_threadPool,
                 [this](Chess::Board nextBoard) {asyncMoveCallback(nextBoard); });
             m_gameState = State::PLAYING;
         }
@@ -263,9 +272,11 @@ public:
         ImGui::Dummy(ImVec2(0.0f, 10.0f));
 
         // Win/Lose Message
-        ImGui::PushStyleColor(ImGuiCol_Text, m_playerWon ? IM_COL32(0, 255, 0, 255) : IM_COL32(255, 0, 0, 255));
+        if (m_gameDrawn)
+            ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(200, 200, 200, 255));
+        else ImGui::PushStyleColor(ImGuiCol_Text, m_playerWon ? IM_COL32(0, 255, 0, 255) : IM_COL32(255, 0, 0, 255));
         ImGui::SetWindowFontScale(1.5f);
-        ImGui::Text(m_playerWon ? "You Won!" : "You Lost!");
+        ImGui::Text(m_gameDrawn ? "Draw!" : m_playerWon ? "You Won!" : "You Lost!");
         ImGui::SetWindowFontScale(1.0f);
         ImGui::PopStyleColor();
 
@@ -336,11 +347,12 @@ public:
             m_ai.abortAndWait();
             auto access = m_board.getWriteAccess();
             access->startNewGame(access->playerIsWhite());
+            m_searchInfo = Chess::Ai::SearchInfo();
             m_ai.reset(!access->playerIsWhite(), m_aiDepth);
 
             // If player is black, AI should make first move
             if (!access->playerIsWhite())
-                m_ai.getBestMoveAsync(access->getBoard(), m_threadPool,
+                m_ai.getBestMoveAsync(access->getBoard(), access->getKeyHistory(), m_threadPool,
                     [this](Chess::Board nextBoard) {asyncMoveCallback(nextBoard); });
             m_gameState = State::PLAYING;
         }
@@ -355,6 +367,32 @@ public:
         ImGui::End();
     }
 
+    // depth, score, speed and expected line of the AI's current or last search, in the top left corner
+    void renderSearchInfo() {
+        while (m_ai.pollSearchInfo(m_searchInfo)) {}
+        if (m_searchInfo.depth == 0)
+            return;
+
+        ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_Always);
+        ImGui::SetNextWindowBgAlpha(0.6f);
+        ImGui::Begin("##SearchInfo", nullptr,
+            ImGuiWindowFlags_AlwaysAutoResize |
+            ImGuiWindowFlags_NoMove |
+            ImGuiWindowFlags_NoCollapse |
+            ImGuiWindowFlags_NoTitleBar |
+            ImGuiWindowFlags_NoInputs);
+
+        std::string pv;
+        for (const auto& move : m_searchInfo.getPv())
+            pv += move.toString() + " ";
+
+        ImGui::Text("Depth %d/%d  Score %d", m_searchInfo.depth, m_searchInfo.selDepth, m_searchInfo.score);
+        ImGui::Text("Nodes %zu  NPS %zu  Hashfull %d", m_searchInfo.nodes,
+            m_searchInfo.nodesPerSecond, m_searchInfo.hashfull);
+        ImGui::Text("PV %s", pv.c_str());
+        ImGui::End();
+    }
+
     void renderLoadingScreen(float globalProgress, float taskProgress) {
         // Get window dimensions and calculate center
         ImVec2 center = ImGui::GetMainViewport()->GetCenter();
@@ -1,9 +1,37 @@
 #pragma once
-#include "Common.h"
+#include <iostream>
+#include <array>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
 
-template <typename IdType = int>
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILER_HAS_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILER_HAS_TSC
+#endif
+
+// Zones are the enumerators of Zone, which ends with Count. A free getZoneName(Zone) found next to the enum names them.
+// Every thread records into its own buffer of counters, only the owning thread writes them, with plain relaxed stores,
+// so a zone costs two timestamp reads and a few stores without locks, allocations or strings. The buffers are summed
+// when a report is asked for, and ticks are converted to time only then. Buffers outlive their threads, a report
+// still counts the threads that finished.
+// Zones entered on every node would still pay more for the timestamps than some of them take, sampled zones count
+// every call but only time one in SAMPLE_INTERVAL, their totals are estimated from the timed calls
+template <typename Zone>
 class Profiler {
 public:
+    static inline const size_t ZONE_COUNT = static_cast<size_t>(Zone::Count);
+    static inline const uint64_t SAMPLE_INTERVAL = 16; // must be a power of two
+
     struct OperationStats {
         double totalTimeMs;
         double avgTimeMs;
@@ -13,123 +41,144 @@ public:
         double stdDev;
     };
 
-    class ScopedTiming {
-    private:
-        Profiler& m_profiler;
-        IdType m_profileId;
-        std::string m_name;
-        std::chrono::steady_clock::time_point m_startTime;
-
-    public:
-        ScopedTiming(Profiler& profiler, IdType profileId, const std::string& name)
-            : m_profiler(profiler)
-            , m_profileId(profileId)
-            , m_name(name)
-            , m_startTime(std::chrono::steady_clock::now())
-        {
-        }
+private:
+    struct ZoneCounters {
+        std::atomic<uint64_t> calls{ 0 };
+        std::atomic<uint64_t> timedCalls{ 0 };
+        std::atomic<uint64_t> ticks{ 0 };
+        std::atomic<uint64_t> minTicks{ UINT64_MAX };
+        std::atomic<uint64_t> maxTicks{ 0 };
+        std::atomic<double> squaredTicks{ 0.0 };
 
-        ~ScopedTiming() {
-            auto duration = std::chrono::steady_clock::now() - m_startTime;
-            std::lock_guard<std::shared_mutex> lock(m_profiler.m_mutex);
-            m_profiler.m_timings[{m_profileId, m_name}].samples.push_back(duration);
+        // owning thread only, the reporter just reads. Returns the zone's call count
+        uint64_t addCall() {
+            uint64_t count = calls.load(std::memory_order_relaxed) + 1;
+            calls.store(count, std::memory_order_relaxed);
+            return count;
         }
 
-        // Delete copy/move operations
-        ScopedTiming(const ScopedTiming&) = delete;
-        ScopedTiming& operator=(const ScopedTiming&) = delete;
-        ScopedTiming(ScopedTiming&&) = delete;
-        ScopedTiming& operator=(ScopedTiming&&) = delete;
-    };
-
-private:
-    struct TimingData {
-        std::vector<std::chrono::duration<double>> samples;
-
-        double getAverage() const {
-            if (samples.empty()) return 0.0;
-            auto total = std::accumulate(samples.begin(), samples.end(),
-                std::chrono::duration<double>(0));
-            return (total.count() * 1000.0) / samples.size();
+        void addTiming(uint64_t duration) {
+            timedCalls.store(timedCalls.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            ticks.store(ticks.load(std::memory_order_relaxed) + duration, std::memory_order_relaxed);
+            if (duration < minTicks.load(std::memory_order_relaxed))
+                minTicks.store(duration, std::memory_order_relaxed);
+            if (duration > maxTicks.load(std::memory_order_relaxed))
+                maxTicks.store(duration, std::memory_order_relaxed);
+            double squared = static_cast<double>(duration) * static_cast<double>(duration);
+            squaredTicks.store(squaredTicks.load(std::memory_order_relaxed) + squared, std::memory_order_relaxed);
         }
 
-        double getTotal() const {
-            auto total = std::accumulate(samples.begin(), samples.end(),
-                std::chrono::duration<double>(0));
-            return total.count() * 1000.0;
+        void clear() {
+            calls.store(0, std::memory_order_relaxed);
+            timedCalls.store(0, std::memory_order_relaxed);
+            ticks.store(0, std::memory_order_relaxed);
+            minTicks.store(UINT64_MAX, std::memory_order_relaxed);
+            maxTicks.store(0, std::memory_order_relaxed);
+            squaredTicks.store(0.0, std::memory_order_relaxed);
         }
     };
 
-    struct PairHash {
-        template <class T1, class T2>
-        std::size_t operator()(const std::pair<T1, T2>& p) const {
-            return std::hash<T1>{}(p.first) ^ (std::hash<T2>{}(p.second) << 1);
-        }
+    // a cache line of its own, threads never write the same line
+    struct alignas(64) ThreadBuffer {
+        std::array<ZoneCounters, ZONE_COUNT> zones;
+        std::atomic<uint32_t> epoch{ 0 }; // the reset this buffer's counters belong to
     };
 
-    std::unordered_map<std::pair<IdType, std::string>, TimingData, PairHash> m_timings;
-    mutable std::shared_mutex m_mutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> m_buffers; // guarded by m_mutex, only grows
+    mutable std::mutex m_mutex;
+    std::atomic<uint32_t> m_epoch{ 0 }; // bumped by reset, every buffer clears itself on its next record
+    uint64_t m_startTicks;
+    std::chrono::steady_clock::time_point m_startTime;
 
-public:
+    Profiler()
+        : m_startTicks(readTicks())
+        , m_startTime(std::chrono::steady_clock::now())
+    {
+    }
 
-    void reset() {
-        std::lock_guard<std::shared_mutex> lock(m_mutex);
-        m_timings.clear();
+    static uint64_t readTicks() {
+#ifdef PROFILER_HAS_TSC
+        return __rdtsc();
+#else
+        return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+    }
+
+    // the first record of a thread registers its buffer, the only time the hot path takes the lock
+    ThreadBuffer& getThreadBuffer() {
+        thread_local ThreadBuffer* t_buffer = nullptr;
+        if (!t_buffer) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_buffers.push_back(std::make_unique<ThreadBuffer>());
+            t_buffer = m_buffers.back().get();
+            t_buffer->epoch.store(m_epoch.load(std::memory_order_relaxed), std::memory_order_release);
+        }
+        return *t_buffer;
+    }
+
+    ZoneCounters& getCounters(Zone zone) {
+        ThreadBuffer& buffer = getThreadBuffer();
+        uint32_t epoch = m_epoch.load(std::memory_order_relaxed);
+        if (buffer.epoch.load(std::memory_order_relaxed) != epoch) {
+            for (auto& counters : buffer.zones)
+                counters.clear();
+            buffer.epoch.store(epoch, std::memory_order_release);
+        }
+        return buffer.zones[static_cast<size_t>(zone)];
     }
 
-    void reset(IdType profileId) {
-        std::lock_guard<std::shared_mutex> lock(m_mutex);
-        
-        std::erase_if(m_timings, [profileId](const auto& pair) {
-            return pair.first.first == profileId;
-            });
+    // measured over the profiler's whole lifetime, so the longer it runs the better the estimate
+    double getTicksPerMs() const {
+        uint64_t ticks = readTicks() - m_startTicks;
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - m_startTime).count();
+#ifdef PROFILER_HAS_TSC
+        return ms > 0.0 ? ticks / ms : 1.0;
+#else
+        return std::chrono::steady_clock::period::den / (std::chrono::steady_clock::period::num * 1000.0);
+#endif
     }
 
-    std::unordered_map<std::string, OperationStats> getStats(IdType profileId) const {
-        std::shared_lock<std::shared_mutex> lock(m_mutex);
-        std::unordered_map<std::string, OperationStats> stats;
-
-        for (const auto& [key, timing] : m_timings) {
-            if (key.first == profileId) {
-                const auto& samples = timing.samples;
-                if (samples.empty()) continue;
-
-                // Calculate min/max
-                auto [min_it, max_it] = std::minmax_element(samples.begin(), samples.end());
-                double minTime = min_it->count() * 1000.0;
-                double maxTime = max_it->count() * 1000.0;
-
-                // Calculate standard deviation
-                double mean = timing.getAverage();
-                double variance = 0.0;
-                for (const auto& sample : samples) {
-                    double diff = (sample.count() * 1000.0) - mean;
-                    variance += diff * diff;
-                }
-                variance /= samples.size();
-                double stdDev = std::sqrt(variance);
-
-                stats[key.second] = {
-                    timing.getTotal(),
-                    timing.getAverage(),
-                    samples.size(),
-                    minTime,
-                    maxTime,
-                    stdDev
-                };
+    std::array<OperationStats, ZONE_COUNT> summarize(const std::vector<const ThreadBuffer*>& buffers) const {
+        double ticksPerMs = getTicksPerMs();
+        uint32_t epoch = m_epoch.load(std::memory_order_relaxed);
+        std::array<OperationStats, ZONE_COUNT> stats;
+
+        for (size_t zone = 0; zone < ZONE_COUNT; zone++) {
+            uint64_t calls = 0, timedCalls = 0, ticks = 0, minTicks = UINT64_MAX, maxTicks = 0;
+            double squaredTicks = 0.0;
+            for (const ThreadBuffer* buffer : buffers) {
+                // not recorded into since the last reset
+                if (buffer->epoch.load(std::memory_order_acquire) != epoch)
+                    continue;
+                const ZoneCounters& counters = buffer->zones[zone];
+                calls += counters.calls.load(std::memory_order_relaxed);
+                timedCalls += counters.timedCalls.load(std::memory_order_relaxed);
+                ticks += counters.ticks.load(std::memory_order_relaxed);
+                minTicks = std::min(minTicks, counters.minTicks.load(std::memory_order_relaxed));
+                maxTicks = std::max(maxTicks, counters.maxTicks.load(std::memory_order_relaxed));
+                squaredTicks += counters.squaredTicks.load(std::memory_order_relaxed);
             }
+
+            double mean = timedCalls ? static_cast<double>(ticks) / timedCalls : 0.0;
+            double variance = timedCalls ? std::max(0.0, squaredTicks / timedCalls - mean * mean) : 0.0;
+            stats[zone] = {
+                mean * calls / ticksPerMs,
+                mean / ticksPerMs,
+                calls,
+                timedCalls ? minTicks / ticksPerMs : 0.0,
+                maxTicks / ticksPerMs,
+                std::sqrt(variance) / ticksPerMs
+            };
         }
         return stats;
     }
 
-    void printStats(IdType profileId) const {
-        auto stats = getStats(profileId);
+    static void print(const std::array<OperationStats, ZONE_COUNT>& stats) {
+        for (size_t zone = 0; zone < ZONE_COUNT; zone++) {
+            const OperationStats& stat = stats[zone];
+            if (stat.calls == 0) continue;
 
-        std::cout << "\nProfiling Results for ID " << profileId << ":\n";
-        std::cout << "==================\n";
-
-        for (const auto& [name, stat] : stats) {
-            std::cout << name << ":\n";
+            std::cout << getZoneName(static_cast<Zone>(zone)) << ":\n";
             std::cout << "  Total time: " << stat.totalTimeMs << "ms\n";
             std::cout << "  Calls: " << stat.calls << "\n";
             std::cout << "  Avg time: " << stat.avgTimeMs << "ms\n";
@@ -140,30 +189,91 @@ public:
         }
     }
 
-    void printAllStats() const {
-        std::shared_lock<std::shared_mutex> lock(m_mutex);
-        std::unordered_set<int> profileIds;
+public:
+    // times one in Interval calls of the zone, counts all of them
+    template <uint64_t Interval>
+    class BasicScopedZone {
+    private:
+        ZoneCounters* m_counters = nullptr; // only set when this call is timed
+        uint64_t m_startTicks = 0;
+
+    public:
+        explicit BasicScopedZone(Zone zone) {
+            ZoneCounters& counters = instance().getCounters(zone);
+            if ((counters.addCall() & (Interval - 1)) == 0) {
+                m_counters = &counters;
+                m_startTicks = readTicks();
+            }
+        }
 
-        for (const auto& [key, _] : m_timings) {
-            profileIds.insert(key.first);
+        ~BasicScopedZone() {
+            if (m_counters)
+                m_counters->addTiming(readTicks() - m_startTicks);
         }
 
-        for (const int& id : profileIds) {
-            printStats(id);
+        // Delete copy/move operations
+        BasicScopedZone(const BasicScopedZone&) = delete;
+        BasicScopedZone& operator=(const BasicScopedZone&) = delete;
+        BasicScopedZone(BasicScopedZone&&) = delete;
+        BasicScopedZone& operator=(BasicScopedZone&&) = delete;
+    };
+
+    using ScopedZone = BasicScopedZone<1>;
+    using SampledScopedZone = BasicScopedZone<SAMPLE_INTERVAL>;
+
+    static Profiler& instance() {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // every thread's counters, each clears itself before it records again
+    void reset() {
+        m_epoch.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the calling thread's counters only
+    void resetThread() {
+        ThreadBuffer& buffer = getThreadBuffer();
+        for (auto& counters : buffer.zones)
+            counters.clear();
+    }
+
+    // summed over every thread, counters being written meanwhile may be a record behind
+    std::array<OperationStats, ZONE_COUNT> getStats() const {
+        std::vector<const ThreadBuffer*> buffers;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (const auto& buffer : m_buffers)
+                buffers.push_back(buffer.get());
         }
+        return summarize(buffers);
+    }
+
+    std::array<OperationStats, ZONE_COUNT> getThreadStats() {
+        return summarize({ &getThreadBuffer() });
     }
 
-    void timeOperation(IdType profileId, const std::string& name, std::function<void()> operation) {
-        auto startTime = std::chrono::steady_clock::now();
-        operation();
-        auto endTime = std::chrono::steady_clock::now();
-        std::lock_guard<std::shared_mutex> lock(m_mutex);
-        auto& timing = m_timings[{profileId, name}];
-        timing.samples.push_back(endTime - startTime);
+    void printStats() const {
+        std::cout << "\nProfiling Results:\n";
+        std::cout << "==================\n";
+        print(getStats());
     }
 
-    [[nodiscard]] auto timeOperationScoped(IdType profileId, const std::string& name) {
-        return ScopedTiming(*this, profileId, name);
+    void printThreadStats() {
+        std::cout << "\nProfiling Results for thread " << std::this_thread::get_id() << ":\n";
+        std::cout << "==================\n";
+        print(getThreadStats());
     }
 };
 
+// Times the rest of the enclosing scope as the given zone, every call or sampled.
+// Without CHESS_PROFILING both compile to nothing
+#ifdef CHESS_PROFILING
+#define PROFILER_CONCAT_INNER(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(zone) ::Profiler<decltype(zone)>::ScopedZone PROFILER_CONCAT(profileZone, __LINE__)(zone)
+#define PROFILE_ZONE_SAMPLED(zone) ::Profiler<decltype(zone)>::SampledScopedZone PROFILER_CONCAT(profileZone, __LINE__)(zone)
+#else
+#define PROFILE_ZONE(zone) ((void)0)
+#define PROFILE_ZONE_SAMPLED(zone) ((void)0)
+#endif
@@ -1,7 +1,344 @@
 #include "Game.h"
+#include "Engine/TexelTuner.h"
+#include "Engine/BenchPositions.h"
+#include "Engine/MicroBenchmarks.h"
+#include "Engine/BenchmarkComparison.h"
 
-int main()
+#include <new>
+#include <cstdlib>
+
+//every allocation of the program, read by the allocs command
+static std::atomic<size_t> g_allocations{ 0 };
+
+void* operator new(std::size_t size)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* memory = std::malloc(size ? size : 1))
+		return memory;
+	throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+	g_allocations.fetch_add(1, std::memory_order_relaxed);
+	size_t align = static_cast<size_t>(alignment);
+#ifdef _MSC_VER
+	void* memory = _aligned_malloc(size ? size : 1, align);
+#else
+	void* memory = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align);
+#endif
+	if (memory)
+		return memory;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+#ifdef _MSC_VER
+void operator delete(void* memory, std::align_val_t) noexcept { _aligned_free(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { _aligned_free(memory); }
+#else
+void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept { std::free(memory); }
+#endif
+
+//every position reached after the given number of plies from the starting position
+static void collectPositions(const Chess::Board& board, bool isWhite, int plies, std::vector<Chess::Board>& positions)
+{
+	if (plies == 0)
+	{
+		positions.push_back(board);
+		return;
+	}
+
+	auto nextBoards = isWhite ?
+		Chess::Calculator::getNextBoardsWhite(board) :
+		Chess::Calculator::getNextBoardsBlack(board);
+	for (const auto& nextBoard : nextBoards)
+		collectPositions(nextBoard, !isWhite, plies - 1, positions);
+}
+
+//Chess evalbench [network file]: evaluations per second of the classical (one by one and batched) and network evaluators,
+//and whether the build has the AVX2 kernels (the Release configurations) or the scalar ones
+static int runEvaluationBenchmark(int argc, char** argv)
+{
+	const int plies = 3;
+	Chess::Board start;
+	start.reset();
+	std::vector<Chess::Board> positions;
+	collectPositions(start, true, plies, positions);
+	bool isWhite = plies % 2 == 0;
+
+	Chess::Ai ai;
+	std::cout << positions.size() << " positions\n";
+#if defined(__AVX2__)
+	std::cout << "Kernels: AVX2\n";
+#else
+	std::cout << "Kernels: scalar, the batched and network evaluations are only vectorised in AVX2 builds\n";
+#endif
+	std::cout << "Classical: " << ai.benchmarkEvaluation(positions, isWhite) << " evals/s\n";
+	std::cout << "Classical, batched: " << ai.benchmarkEvaluation(positions, isWhite, 10, true) << " evals/s\n";
+
+	if (argc > 2)
+	{
+		if (!ai.loadNetwork(argv[2]))
+			return 1;
+		ai.setEvaluator(Chess::Ai::Evaluator::NNUE);
+		std::cout << "NNUE: " << ai.benchmarkEvaluation(positions, isWhite) << " evals/s\n";
+	}
+	return 0;
+}
+
+//Chess tune <dataset> [epochs] [output file]: Texel tuning of the piece values and piece-square tables
+static int runTuner(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cout << "usage: tune <dataset> [epochs] [output file]\n";
+		return 1;
+	}
+
+	int epochs = argc > 3 ? std::stoi(argv[3]) : 100;
+	std::string output = argc > 4 ? argv[4] : "TunedParameters.txt";
+
+	MT::ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	Chess::TexelTuner tuner(pool);
+	if (tuner.loadDataset(argv[2]) == 0)
+		return 1;
+
+	tuner.tune(epochs);
+	return tuner.writeParameters(output) ? 0 : 1;
+}
+
+//Chess analyze "<fen>" [lines] [depth]: the best lines of a position, with the cost of searching them over a single line
+static int runAnalysis(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cout << "usage: analyze \"<fen>\" [lines] [depth]\n";
+		return 1;
+	}
+
+	bool isWhite;
+	auto board = Chess::Board::fromFen(argv[2], isWhite);
+	if (!board)
+	{
+		std::cout << "Invalid fen " << argv[2] << "\n";
+		return 1;
+	}
+	size_t lineCount = argc > 3 ? std::stoul(argv[3]) : 3;
+	size_t depth = argc > 4 ? std::stoul(argv[4]) : 5;
+
+	//fresh ais, so neither search profits from the other's caches
+	Chess::Ai singleAi;
+	singleAi.reset(isWhite, depth);
+	auto start = std::chrono::steady_clock::now();
+	singleAi.getBestMove(*board);
+	double singleSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	size_t singleNodes = singleAi.getSearchStatistics().nodes;
+
+	Chess::Ai ai;
+	ai.reset(isWhite, depth);
+	start = std::chrono::steady_clock::now();
+	auto lines = ai.analyze(*board, lineCount);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	size_t nodes = ai.getSearchStatistics().nodes;
+
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		std::cout << i + 1 << ". score " << lines[i].score << " pv";
+		for (const auto& move : lines[i].pv)
+			std::cout << " " << move.toString();
+		std::cout << "\n";
+	}
+	std::cout << "MultiPV: " << nodes << " nodes, " << seconds * 1000.0 << " ms\n";
+	std::cout << "Single PV: " << singleNodes << " nodes, " << singleSeconds * 1000.0 << " ms\n";
+	std::cout << "Cost: " << (singleNodes ? static_cast<double>(nodes) / singleNodes : 0.0) << "x nodes, "
+		<< (singleSeconds > 0 ? seconds / singleSeconds : 0.0) << "x time\n";
+	return 0;
+}
+
+//Chess bench [depth] [threads] [hash MB] [output file] [runs]: deterministic searches of the bench positions, the
+//total node count is a signature of the search's behaviour and only changes when the searched trees do. The hash is
+//the eval cache, each thread's search has its own, 0 keeps the default size. Its hits can change the tree, so only
+//signatures of the same depth and hash size are comparable. The output file gets the ns per node of every run as
+//JSON, with the signature, for the compare command
+static int runBench(int argc, char** argv)
+{
+	size_t depth = argc > 2 ? std::stoul(argv[2]) : 5;
+	unsigned int threads = argc > 3 ? std::stoul(argv[3]) : 1;
+	size_t hashMegabytes = argc > 4 ? std::stoul(argv[4]) : 0;
+	size_t hashBytes = hashMegabytes ? hashMegabytes << 20 : Chess::EvalCache::DEFAULT_SIZE * Chess::EvalCache::ENTRY_SIZE;
+	size_t runs = std::max<size_t>(1, argc > 6 ? std::stoul(argv[6]) : argc > 5 ? 10 : 1);
+
+	struct Result
+	{
+		std::string move;
+		size_t nodes = 0;
+		double seconds = 0.0;
+	};
+	std::vector<Result> results(Chess::BENCH_POSITIONS.size());
+	MT::ThreadPool pool(std::max(1u, threads));
+#ifdef CHESS_PROFILING
+	Profiler<Chess::SearchZone>::instance().reset();
+#endif
+
+	size_t nodes = 0;
+	double seconds = 0.0;
+	std::vector<double> samples;
+	for (size_t run = 0; run < runs; run++)
+	{
+		std::vector<std::function<void()>> tasks;
+		for (size_t i = 0; i < Chess::BENCH_POSITIONS.size(); i++)
+		{
+			tasks.push_back([i, depth, hashBytes, &results]() {
+				bool isWhite;
+				auto board = Chess::Board::fromFen(Chess::BENCH_POSITIONS[i], isWhite);
+				auto ai = std::make_unique<Chess::Ai>();
+				ai->setEvalCacheSize(hashBytes);
+				ai->reset(isWhite, depth);
+
+				auto start = std::chrono::steady_clock::now();
+				Chess::Board best = ai->getBestMoveDeterministic(*board);
+				results[i].seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				results[i].nodes = ai->getSearchStatistics().nodes;
+				results[i].move = best.getLastMove().toString();
+				});
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		pool.pushTasks(std::move(tasks));
+		pool.waitForAll();
+		double runSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		nodes = 0;
+		for (const auto& result : results)
+			nodes += result.nodes;
+		seconds += runSeconds;
+		samples.push_back(nodes ? runSeconds * 1e9 / nodes : 0.0);
+	}
+
+	for (size_t i = 0; i < results.size(); i++)
+	{
+		std::cout << "Position " << i + 1 << ": " << results[i].move << ", " << results[i].nodes << " nodes, "
+			<< results[i].seconds * 1000.0 << " ms\n";
+	}
+	seconds /= runs;
+	std::cout << "==================\n";
+	std::cout << "Depth: " << depth << ", threads: " << std::max(1u, threads) << ", hash: " << hashBytes / double(1 << 20) << " MB\n";
+	std::cout << "Nodes: " << nodes << "\n";
+	std::cout << "Time: " << seconds * 1000.0 << " ms" << (runs > 1 ? " (mean of " + std::to_string(runs) + " runs)" : "") << "\n";
+	std::cout << "NPS: " << static_cast<size_t>(seconds > 0 ? nodes / seconds : 0) << "\n";
+#ifdef CHESS_PROFILING
+	Profiler<Chess::SearchZone>::instance().printStats();
+#endif
+
+	if (argc > 5)
+	{
+		auto result = Chess::MicroBenchmarks::summarize("bench", nodes, std::move(samples));
+		return Chess::MicroBenchmarks::writeJson(argv[5], { result }, nodes) ? 0 : 1;
+	}
+	return 0;
+}
+
+//Chess microbench [output file] [filter]: timings of the move generators, attack lookups, evaluation, move ordering
+//and board copies, the benchmarks whose name contains the filter only. The output file gets the results as JSON
+static int runMicroBenchmarks(int argc, char** argv)
+{
+	Chess::MicroBenchmarks benchmarks;
+	benchmarks.run(argc > 3 ? argv[3] : "");
+	if (argc > 2)
+		return benchmarks.writeJson(argv[2]) ? 0 : 1;
+	return 0;
+}
+
+//Chess compare <baseline file> <candidate file> [threshold %] [confidence %]: compares the results of two microbench
+//or bench runs, exits with 1 when a benchmark got slower by more than the threshold (2%) with the given confidence (95%)
+static int runComparison(int argc, char** argv)
 {
+	if (argc < 4)
+	{
+		std::cout << "Usage: Chess compare <baseline file> <candidate file> [threshold %] [confidence %]\n";
+		return 1;
+	}
+
+	auto baseline = Chess::BenchmarkComparison::read(argv[2]);
+	auto candidate = Chess::BenchmarkComparison::read(argv[3]);
+	if (!baseline || !candidate)
+		return 1;
+
+	double threshold = argc > 4 ? std::stod(argv[4]) / 100.0 : Chess::BenchmarkComparison::DEFAULT_THRESHOLD;
+	double confidence = argc > 5 ? std::stod(argv[5]) / 100.0 : Chess::BenchmarkComparison::DEFAULT_CONFIDENCE;
+	Chess::BenchmarkComparison comparison(threshold, confidence);
+	return comparison.report(*baseline, *candidate) ? 1 : 0;
+}
+
+//Chess allocs [depth]: searches of the bench positions on one Ai after a first one allocated its search stack,
+//caches and buffers. The searches must not allocate, exits with 1 when one did
+static int runAllocationCheck(int argc, char** argv)
+{
+	size_t depth = argc > 2 ? std::stoul(argv[2]) : 5;
+
+	std::vector<Chess::Board> boards;
+	std::vector<bool> sides;
+	for (const char* fen : Chess::BENCH_POSITIONS)
+	{
+		bool isWhite;
+		boards.push_back(*Chess::Board::fromFen(fen, isWhite));
+		sides.push_back(isWhite);
+	}
+
+	Chess::Ai ai;
+	std::vector<uint64_t> keyHistory;
+	keyHistory.reserve(1);
+	ai.reset(sides.front(), depth);
+	ai.getBestMove(boards.front(), keyHistory);
+
+	size_t failures = 0;
+	for (size_t i = 0; i < boards.size(); i++)
+	{
+		ai.reset(sides[i], depth);
+		size_t before = g_allocations.load(std::memory_order_relaxed);
+		ai.getBestMove(boards[i], keyHistory);
+		size_t allocations = g_allocations.load(std::memory_order_relaxed) - before;
+
+		if (allocations)
+		{
+			std::cout << "Position " << i + 1 << ": " << allocations << " allocations in "
+				<< ai.getSearchStatistics().nodes << " nodes\n";
+			failures++;
+		}
+	}
+	std::cout << failures << " of " << boards.size() << " searches allocated\n";
+	return failures ? 1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	//Chess --parameters <file> [...]: evaluation weights read from a file, needs a build with CHESS_RUNTIME_EVAL_PARAMETERS
+	if (argc > 2 && std::string(argv[1]) == "--parameters")
+	{
+		if (!Chess::loadEvalParameters(argv[2]))
+			return 1;
+		argc -= 2;
+		argv += 2;
+	}
+
+	if (argc > 1 && std::string(argv[1]) == "evalbench")
+		return runEvaluationBenchmark(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "tune")
+		return runTuner(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "analyze")
+		return runAnalysis(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "bench")
+		return runBench(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "microbench")
+		return runMicroBenchmarks(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "compare")
+		return runComparison(argc, argv);
+	if (argc > 1 && std::string(argv[1]) == "allocs")
+		return runAllocationCheck(argc, argv);
+
 	Game game;
 	return game.run();
-}
\ No newline at end of file
+}